@@ -0,0 +1,94 @@
+/**
+ * SAD / ブロックコピーのマイクロベンチマーク
+ *
+ * ブロックの横幅毎に、実行時の横幅で処理する汎用カーネルと
+ * 固定幅のカーネルの1ブロックあたりの処理時間を比較する
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <string>
+
+#include "../image/sad.hpp"
+#include "../image/utils.hpp"
+
+namespace
+{
+	const int frame_width  = 1024;
+	const int frame_height = 1024;
+
+	/**
+	 * 1ブロックあたりの処理時間 [ns]
+	 *
+	 * フレーム内の位置をずらしながら repeat 回呼び出す
+	 */
+	template <typename F>
+	double measure (F func, const unsigned int block_size, const int repeat)
+	{
+		const int span = frame_width - 2 * block_size;
+		auto start = std::chrono::steady_clock::now();
+
+		for (int i=0; i<repeat; ++i) {
+			int x = (i * 37) % span;
+			int y = (i * 11) % (frame_height - 2 * block_size);
+			func(x, y);
+		}
+
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / repeat;
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	const int repeat = (argc > 1) ? std::stoi(argv[1]) : 2000000;
+
+	std::vector<unsigned char> a(frame_width * frame_height), b(frame_width * frame_height);
+	for (std::size_t i=0; i<a.size(); ++i) {
+		a[i] = static_cast<unsigned char>((i * 37 + i / 97) & 0xff);
+		b[i] = static_cast<unsigned char>((i * 91 + i / 89 + 13) & 0xff);
+	}
+	std::vector<unsigned char> c(a.size());
+
+	std::cout << "kernel: " << Image::sad::kernel_name() << std::endl;
+	std::cout << std::setw(6) << "size"
+	          << std::setw(14) << "sad [ns]" << std::setw(14) << "fixed [ns]" << std::setw(10) << "speedup"
+	          << std::setw(14) << "copy [ns]" << std::setw(14) << "fixed [ns]" << std::setw(10) << "speedup"
+	          << std::endl;
+
+	volatile unsigned int sink = 0;
+
+	for (unsigned int bs : {4u, 8u, 16u, 32u}) {
+		const Image::sad::kernel_type generic = Image::sad::select();
+		const Image::sad::kernel_type fixed   = Image::sad::select(bs);
+		const int n = repeat * 16 / bs;
+
+		double t_sad = measure([&](int x, int y) {
+			sink += generic(&a[x + y*frame_width], frame_width, &b[x+1 + (y+1)*frame_width], frame_width, bs, bs);
+		}, bs, n);
+		double t_fixed = measure([&](int x, int y) {
+			sink += fixed(&a[x + y*frame_width], frame_width, &b[x+1 + (y+1)*frame_width], frame_width, bs, bs);
+		}, bs, n);
+
+		typedef Image::block_copy<unsigned char> block_copy;
+		const block_copy::kernel_type copy_fixed = block_copy::select(bs);
+
+		double t_copy = measure([&](int x, int y) {
+			block_copy::copy(&a[x + y*frame_width], frame_width, &c[x+1 + y*frame_width], frame_width, bs, bs);
+		}, bs, n);
+		double t_copy_fixed = measure([&](int x, int y) {
+			copy_fixed(&a[x + y*frame_width], frame_width, &c[x+1 + y*frame_width], frame_width, bs, bs);
+		}, bs, n);
+		sink += c[frame_width + 2];
+
+		std::cout << std::fixed << std::setprecision(2)
+		          << std::setw(6) << bs
+		          << std::setw(14) << t_sad << std::setw(14) << t_fixed << std::setw(10) << t_sad / t_fixed
+		          << std::setw(14) << t_copy << std::setw(14) << t_copy_fixed << std::setw(10) << t_copy / t_copy_fixed
+		          << std::endl;
+	}
+
+	return (sink == 0xffffffff) ? 1 : 0;
+}
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
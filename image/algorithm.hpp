@@ -3,58 +3,259 @@
 
 #include <limits>
 #include <utility>
+#include <algorithm>
+#include <type_traits>
 #include <cmath>
+#include <vector>
+#include <initializer_list>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "container.hpp"
+#include "sad.hpp"
+#include "thread.hpp"
+#include "frame.hpp"
+#include "padded.hpp"
 
 namespace Image 
 {
 	typedef std::pair<int, int> ve_pair;
 	typedef container<ve_pair>  ve_container;
 
+	/**
+	 * 探索の統計情報
+	 */
+	struct search_info
+	{
+		double match;  //マッチング回数
+		double pruned; //枝刈りした候補数
+		double rows;   //差分絶対値和で評価した行数
+		double cost;   //選択した動きベクトルの差分絶対値和
+		double subpel; //小数画素精度の改良で評価した候補数
+
+		search_info ()
+			: match(0), pruned(0), rows(0), cost(0), subpel(0)
+		{
+		}
+
+		/**
+		 * 加算
+		 *
+		 * @param obj 統計情報
+		 * @return 加算結果
+		 */
+		search_info& operator+= (const search_info &obj)
+		{
+			match  += obj.match;
+			pruned += obj.pruned;
+			rows   += obj.rows;
+			cost   += obj.cost;
+			subpel += obj.subpel;
+			return *this;
+		}
+
+		/**
+		 * 除算
+		 *
+		 * @param n 除数
+		 * @return 除算結果
+		 */
+		search_info& operator/= (const double n)
+		{
+			match  /= n;
+			pruned /= n;
+			rows   /= n;
+			cost   /= n;
+			subpel /= n;
+			return *this;
+		}
+	};
+
+	/**
+	 * 周囲のブロックの結果を参照する検出アルゴリズムか
+	 *
+	 * 検出アルゴリズムが型 causal_search を定義していれば true となり、
+	 * 探索済みの動きベクトルと統計情報が渡される
+	 */
+	template <typename Function>
+	struct is_causal_search
+	{
+	private:
+		template <typename F>
+		static std::true_type test (typename F::causal_search *);
+
+		template <typename F>
+		static std::false_type test (...);
+
+	public:
+		static const bool value = decltype(test<Function>(nullptr))::value;
+	};
+
+	/**
+	 * 1ブロックの探索
+	 */
+	template <typename Map, typename Function>
+	inline
+	ve_pair _search_block (
+		const Function &func,
+		const Map &premap, const Map &crtmap,
+		const int x, const int y,
+		const unsigned int macro_block_size,
+		const unsigned int search_size,
+		search_info *info,
+		const ve_container &/*ve*/,
+		const container<search_info> &/*stats*/,
+		std::false_type )
+	{
+		return func(premap, crtmap, x, y, macro_block_size, search_size, info);
+	}
+
+	/**
+	 * 1ブロックの探索 (周囲のブロックの結果を参照)
+	 */
+	template <typename Map, typename Function>
+	inline
+	ve_pair _search_block (
+		const Function &func,
+		const Map &premap, const Map &crtmap,
+		const int x, const int y,
+		const unsigned int macro_block_size,
+		const unsigned int search_size,
+		search_info *info,
+		const ve_container &ve,
+		const container<search_info> &stats,
+		std::true_type )
+	{
+		return func(premap, crtmap, x, y, macro_block_size, search_size, info, ve, stats);
+	}
+
+	/**
+	 * 波面状の探索での行毎の進捗
+	 *
+	 * 下の行のスレッドは待機中に CPU を使わないよう条件変数で待つ
+	 */
+	struct _row_progress
+	{
+		//探索済みブロック数
+		std::atomic<int> done;
+		std::mutex mutex;
+		std::condition_variable cond;
+
+		_row_progress ()
+			: done(0)
+		{
+		}
+
+		/**
+		 * 探索済みブロック数の更新と待機中のスレッドへの通知
+		 *
+		 * @param n 探索済みブロック数
+		 */
+		void advance (const int n)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done.store(n, std::memory_order_release);
+			}
+			cond.notify_one();
+		}
+
+		/**
+		 * 探索済みブロック数が need 以上になるまで待機
+		 *
+		 * @param need 必要なブロック数
+		 */
+		void wait (const int need)
+		{
+			if (done.load(std::memory_order_acquire) >= need) {
+				return;
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [&] { return done.load(std::memory_order_acquire) >= need; });
+		}
+	};
+
 	/**
 	 * 動きベクトル検出
 	 *
+	 * マクロブロックの行単位で並列に探索する
+	 * 周囲のブロックの結果を参照する検出アルゴリズムでは、
+	 * 左・上・右上のブロックの探索終了を待ちながら波面状に処理する
+	 * 結果はスレッド数に関係なく逐次実行と一致する
+	 *
 	 * @param premap 原画像
 	 * @param crtmap 次画像
 	 * @param macro_block_size ブロックのサイズ
 	 * @param search_size ブロックの探索範囲
 	 * @param func 検出アルゴリズム
-	 * @param info 平均マッチング回数
+	 * @param info ブロック当たりの平均統計情報
+	 * @param pool 並列実行に使用するスレッドプール (nullptr:逐次実行)
 	 * @return マクロブロックの動きベクトルのコンテナ
 	 */
-	template <typename T, typename Function>
+	template <typename Map, typename Function>
 	ve_container motion_vector_search (
-		const container<T> &premap,
-		const container<T> &crtmap,
+		const Map &premap,
+		const Map &crtmap,
 		const unsigned int macro_block_size,
 		const unsigned int search_size,
 		const Function &func,
-		double *info )
+		search_info *info,
+		thread_pool *pool = nullptr )
 	{
+		typedef std::integral_constant<bool, is_causal_search<Function>::value> causal;
+
 		ve_container ve (
 			premap.width()  / macro_block_size,
 			premap.height() / macro_block_size );
 
-		double count = 0;
+		//ブロック毎の統計情報
+		container<search_info> count(ve.width(), ve.height());
 
-		//探索開始点
-		for (int my=0; my * macro_block_size < premap.height(); ++my) {
-			for (int mx=0; mx * macro_block_size < premap.width(); ++mx) {
-				//探索
-				double sad = std::numeric_limits<double>::max();
+		//行毎の進捗 (周囲のブロックの結果を参照する場合のみ使う)
+		std::unique_ptr<_row_progress[]> progress(causal::value ? new _row_progress[ve.height()] : nullptr);
+
+		//1行分の探索
+		auto search_row = [&](int my) {
+			for (int mx=0; mx < ve.width(); ++mx) {
 				int x = mx * macro_block_size;
 				int y = my * macro_block_size;
-				int c;
+
+				//上の行の左上・上・右上ブロックの探索終了を待つ
+				if (causal::value && my > 0) {
+					progress[my-1].wait(std::min(mx + 2, ve.width()));
+				}
 
 				//動きベクトル取得
-				ve(mx, my) = func(premap, crtmap, x, y, macro_block_size, search_size, &c);
-				count += c;
+				ve(mx, my) = _search_block (
+					func, premap, crtmap, x, y, macro_block_size, search_size,
+					&count(mx, my), ve, count, causal()
+				);
+				if (causal::value) {
+					progress[my].advance(mx + 1);
+				}
+			}
+		};
+
+		//探索開始点
+		if (pool != nullptr) {
+			pool->parallel_for(0, ve.height(), search_row);
+		}
+		else {
+			for (int my=0; my < ve.height(); ++my) {
+				search_row(my);
 			}
 		}
 
-		//平均回数の保存
+		//平均の保存
 		if (info != nullptr) {
-			*info = count / ve.width() / ve.height();
+			search_info sum;
+			for (auto it = count.begin(); it != count.end(); ++it) {
+				sum += *it;
+			}
+			sum /= ve.width();
+			sum /= ve.height();
+			*info = sum;
 		}
 
 		return ve;
@@ -65,34 +266,72 @@ namespace Image
 	{
 		/**
 		 * 検出アルゴリズム ベースクラス
+		 *
+		 * 画像は container の他に padded (周囲を拡張した画像) も扱える
 		 */
 		struct _base_search_algorithm
 		{
 			/**
 			 * マクロブロックが対象画像からはみ出すか検査
 			 *
+			 * 拡張画像では拡張した範囲まで参照できる
+			 *
 			 * @param premap 対象画像
 			 * @param x マクロブロック左上 x座標
 			 * @param y マクロブロック左上 y座標
 			 * @param macro_block_size ブロックのサイズ
 			 * @return true:マクロブロックが対象画像からはみ出す
 			 */
-			template <typename T>
+			template <typename Map>
 			inline
 			bool is_over_edge (
-				const container<T> &imgmap,
+				const Map &imgmap,
 				const int x, const int y,
 				const unsigned int macro_block_size ) const
 			{
+				int m = edge_margin(imgmap);
+				int bs = macro_block_size;
 				return (
-					(y < 0) || (x < 0) ||
-					(y+macro_block_size > imgmap.height()) ||
-					(x+macro_block_size > imgmap.width()) );
+					(y < -m) || (x < -m) ||
+					(y+bs > imgmap.height()+m) ||
+					(x+bs > imgmap.width()+m) );
+			}
+
+			/**
+			 * 画像からはみ出さない探索範囲
+			 *
+			 * @param imgmap 対象画像
+			 * @param x マクロブロック左上 x座標
+			 * @param y マクロブロック左上 y座標
+			 * @param macro_block_size ブロックのサイズ
+			 * @param search_size ブロックの探索範囲
+			 * @param lower 探索範囲の下限 (x, y) の保存先
+			 * @param upper 探索範囲の上限 (x, y) の保存先
+			 */
+			template <typename Map>
+			inline
+			void clip_search_range (
+				const Map &imgmap,
+				const int x, const int y,
+				const unsigned int macro_block_size,
+				const unsigned int search_size,
+				ve_pair *lower, ve_pair *upper ) const
+			{
+				int m = edge_margin(imgmap);
+				int bs = macro_block_size;
+				int search = static_cast<int>(search_size);
+
+				lower->first  = std::max(-search, -m - x);
+				lower->second = std::max(-search, -m - y);
+				upper->first  = std::min(search, imgmap.width()  + m - bs - x);
+				upper->second = std::min(search, imgmap.height() + m - bs - y);
 			}
 
 			/**
 			 * 2ブロック間の差分絶対値和
 			 *
+			 * 8bit画素はSIMDカーネルを使用する
+			 *
 			 * @param map1 ブロック1
 			 * @param x1 ブロック1の左上 x座標
 			 * @param y1 ブロック1の左上 y座標
@@ -102,23 +341,111 @@ namespace Image
 			 * @param macro_block_size ブロックのサイズ
 			 * @return 差分絶対値和
 			 */
-			template <typename T>
+			template <typename Map1, typename Map2>
 			inline
-			double sum_of_absolute_difference (
-				const container<T> &map1, const int x1, const int y1,
-				const container<T> &map2, const int x2, const int y2,
+			typename sad_traits<typename Map1::value_type>::type sum_of_absolute_difference (
+				const Map1 &map1, const int x1, const int y1,
+				const Map2 &map2, const int x2, const int y2,
 				const unsigned int block_size ) const
 			{
-				double sum = 0;
+				return sum_of_absolute_difference (
+					map1, x1, y1, map2, x2, y2, block_size,
+					std::numeric_limits<typename sad_traits<typename Map1::value_type>::type>::max(),
+					nullptr
+				);
+			}
+
+			/**
+			 * 2ブロック間の差分絶対値和 (打ち切り付き)
+			 *
+			 * 行毎に途中の和を bound と比較し、bound 以上になった時点で打ち切る
+			 * 打ち切った場合は bound 以上の途中の和を返すため、
+			 * 暫定最小値を bound とすれば探索結果は変わらない
+			 * 8bit画素はSIMDカーネルで数行ずつ計算し、行グループ毎に判定する
+			 *
+			 * @param map1 ブロック1
+			 * @param x1 ブロック1の左上 x座標
+			 * @param y1 ブロック1の左上 y座標
+			 * @param map2 ブロック2
+			 * @param x2 ブロック2の左上 x座標
+			 * @param y2 ブロック2の左上 y座標
+			 * @param macro_block_size ブロックのサイズ
+			 * @param bound 打ち切り値
+			 * @param rows 評価した行数の保存先
+			 * @return 差分絶対値和
+			 */
+			template <typename Map1, typename Map2>
+			inline
+			typename sad_traits<typename Map1::value_type>::type sum_of_absolute_difference (
+				const Map1 &map1, const int x1, const int y1,
+				const Map2 &map2, const int x2, const int y2,
+				const unsigned int block_size,
+				const typename sad_traits<typename Map1::value_type>::type bound,
+				unsigned int *rows ) const
+			{
+				typedef typename Map1::value_type value_type;
+
+				return bounded_sad (
+					map1, x1, y1, map2, x2, y2, block_size, bound, rows,
+					std::is_same<value_type, unsigned char>()
+				);
+			}
+
+		private:
+			/**
+			 * 打ち切り付き差分絶対値和 (汎用)
+			 */
+			template <typename Map1, typename Map2>
+			inline
+			typename sad_traits<typename Map1::value_type>::type bounded_sad (
+				const Map1 &map1, const int x1, const int y1,
+				const Map2 &map2, const int x2, const int y2,
+				const unsigned int block_size,
+				const typename sad_traits<typename Map1::value_type>::type bound,
+				unsigned int *rows,
+				std::false_type ) const
+			{
+				typename sad_traits<typename Map1::value_type>::type sum = 0;
+				unsigned int iy = 0;
 
-				for (int iy=0; iy<block_size; ++iy) {
-					for (int ix=0; ix<block_size; ++ix) {
+				while (iy < block_size) {
+					for (int ix=0; ix<static_cast<int>(block_size); ++ix) {
 						sum += abs(map1(x1+ix, y1+iy) - map2(x2+ix, y2+iy));
 					}
+					++iy;
+
+					if (sum >= bound) {
+						break;
+					}
+				}
+
+				if (rows != nullptr) {
+					*rows = iy;
 				}
 
 				return sum;
 			}
+
+			/**
+			 * 打ち切り付き差分絶対値和 (8bit画素)
+			 */
+			template <typename Map1, typename Map2>
+			inline
+			unsigned int bounded_sad (
+				const Map1 &map1, const int x1, const int y1,
+				const Map2 &map2, const int x2, const int y2,
+				const unsigned int block_size,
+				const unsigned int bound,
+				unsigned int *rows,
+				std::true_type ) const
+			{
+				return sad::compute_bounded (
+					&map1(x1, y1), map1.stride(),
+					&map2(x2, y2), map2.stride(),
+					block_size, block_size,
+					bound, rows
+				);
+			}
 		};
 
 		/**
@@ -133,29 +460,151 @@ namespace Image
 			 * @param y マクロブロック左上 y座標
 			 * @param macro_block_size ブロックのサイズ
 			 * @param search_size ブロックの探索範囲
-			 * @param info マッチング回数
+			 * @param info 探索の統計情報
 			 * @return 動きベクトル
 			 */
-			template <typename T>
+			template <typename Ref, typename Cur>
 			ve_pair operator() (
-				const container<T> &premap,
-				const container<T> &crtmap,
+				const Ref &premap,
+				const Cur &crtmap,
 				const int x, const int y,
 				const unsigned int macro_block_size,
 				const unsigned int search_size,
-				int *info ) const
+				search_info *info ) const
 			{
-				double sad = std::numeric_limits<double>::max();
+				typedef typename sad_traits<typename Cur::value_type>::type sad_type;
+				sad_type sad = std::numeric_limits<sad_type>::max();
 				int vex = 0;
 				int vey = 0;
 				int count = 0;
+				unsigned int rows = 0;
 
 				// -search_size 〜 search_size の範囲で探索
-				int search = static_cast<int>(search_size);
-				for (int dy = -search; dy <= search; ++dy) {
-					for (int dx = -search; dx <= search; ++dx) {
-						//画像端は処理対象外
-						if (is_over_edge(premap, x+dx, y+dy, macro_block_size)) {
+				// (画像端からはみ出す候補は範囲から除く)
+				ve_pair lower, upper;
+				clip_search_range(premap, x, y, macro_block_size, search_size, &lower, &upper);
+
+				for (int dy = lower.second; dy <= upper.second; ++dy) {
+					for (int dx = lower.first; dx <= upper.first; ++dx) {
+						//回数カウント
+						++count;
+
+						//誤差計算
+						unsigned int n;
+						auto sum = sum_of_absolute_difference (
+							crtmap, x, y,
+							premap, x+dx, y+dy,
+							macro_block_size,
+							sad, &n
+						);
+						rows += n;
+
+						//ベクトル保存
+						if (sad > sum) {
+							sad = sum;
+							vex = dx;
+							vey = dy;
+						}
+					}
+				}
+
+				//回数の保存
+				if (info != nullptr) {
+					info->match = count;
+					info->rows  = rows;
+					info->cost  = sad;
+				}
+
+				return {vex, vey};
+			}
+		};
+
+		/**
+		 * 検出アルゴリズム successive elimination (SEA / multilevel SEA)
+		 *
+		 * ブロック和の差 |sum(cur) - sum(ref)| は差分絶対値和の下限となるため、
+		 * 下限が暫定最小値以上の候補は差分絶対値和を計算せずに除外する
+		 * levels > 0 ではブロックを 2^l x 2^l に分割した部分ブロック和の
+		 * 差の総和を l = 1..levels の順に下限として用いる (multilevel SEA)
+		 * 結果は full search と一致する
+		 * 画像は積分画像を持つ frame または padded を用いる
+		 */
+		struct successive_elimination : public _base_search_algorithm
+		{
+			unsigned int levels;
+
+			/**
+			 * @param levels multilevel SEA の段数 (0:SEA)
+			 */
+			explicit successive_elimination (unsigned int levels = 0)
+				: levels(levels)
+			{
+			}
+
+			/**
+			 * @param premap 原画像
+			 * @param crtmap 次画像
+			 * @param x マクロブロック左上 x座標
+			 * @param y マクロブロック左上 y座標
+			 * @param macro_block_size ブロックのサイズ
+			 * @param search_size ブロックの探索範囲
+			 * @param info 探索の統計情報
+			 * @return 動きベクトル
+			 */
+			template <typename Ref, typename Cur>
+			ve_pair operator() (
+				const Ref &premap,
+				const Cur &crtmap,
+				const int x, const int y,
+				const unsigned int macro_block_size,
+				const unsigned int search_size,
+				search_info *info ) const
+			{
+				typedef typename sad_traits<typename Cur::value_type>::type sum_type;
+
+				const auto &presum = premap.integral();
+				const auto &crtsum = crtmap.integral();
+
+				//ブロックを等分できる段数まで
+				unsigned int level_max = 0;
+				while (level_max < levels
+					&& macro_block_size % (2u << level_max) == 0)
+				{
+					++level_max;
+				}
+
+				//対象ブロックの部分ブロック和 (段 l は 4^l 個を段の順に並べる)
+				//領域はスレッド毎に再利用し、マクロブロック毎には確保しない
+				static thread_local std::vector<sum_type> crtblock;
+				crtblock.resize(((static_cast<std::size_t>(4) << (2 * level_max)) - 1) / 3);
+				for (unsigned int l=0, offset=0; l<=level_max; ++l) {
+					unsigned int n = 1u << l;
+					unsigned int bs = macro_block_size >> l;
+					for (unsigned int iy=0; iy<n; ++iy) {
+						for (unsigned int ix=0; ix<n; ++ix) {
+							crtblock[offset + ix + iy*n] = crtsum.sum(x+ix*bs, y+iy*bs, bs, bs);
+						}
+					}
+					offset += n * n;
+				}
+
+				sum_type sad = std::numeric_limits<sum_type>::max();
+				int vex = 0;
+				int vey = 0;
+				int count = 0;
+				unsigned int rows = 0;
+				int pruned = 0;
+
+				// -search_size 〜 search_size の範囲で探索
+				// (画像端からはみ出す候補は範囲から除く)
+				ve_pair lower, upper;
+				clip_search_range(premap, x, y, macro_block_size, search_size, &lower, &upper);
+
+				for (int dy = lower.second; dy <= upper.second; ++dy) {
+					for (int dx = lower.first; dx <= upper.first; ++dx) {
+						//下限による除外
+						if (is_eliminated(presum, crtblock.data(), level_max, x+dx, y+dy, macro_block_size, sad)) {
+							++pruned;
 							continue;
 						}
 
@@ -163,11 +612,14 @@ namespace Image
 						++count;
 
 						//誤差計算
-						double sum = sum_of_absolute_difference (
+						unsigned int n;
+						auto sum = sum_of_absolute_difference (
 							crtmap, x, y,
 							premap, x+dx, y+dy,
-							macro_block_size
+							macro_block_size,
+							sad, &n
 						);
+						rows += n;
 
 						//ベクトル保存
 						if (sad > sum) {
@@ -180,15 +632,67 @@ namespace Image
 
 				//回数の保存
 				if (info != nullptr) {
-					*info = count;
+					info->match  = count;
+					info->pruned = pruned;
+					info->rows   = rows;
+					info->cost   = sad;
 				}
 
 				return {vex, vey};
 			}
+
+		private:
+			/**
+			 * 下限による候補の除外判定
+			 *
+			 * @param presum 原画像の積分画像
+			 * @param crtblock 対象ブロックの部分ブロック和 (段 0..level_max の順)
+			 * @param level_max 部分ブロック和の最大の段
+			 * @param x 候補ブロック左上 x座標
+			 * @param y 候補ブロック左上 y座標
+			 * @param macro_block_size ブロックのサイズ
+			 * @param sad 暫定最小値
+			 * @return true:下限が暫定最小値以上
+			 */
+			template <typename V>
+			inline
+			bool is_eliminated (
+				const integral_image<V> &presum,
+				const V *crtblock,
+				const unsigned int level_max,
+				const int x, const int y,
+				const unsigned int macro_block_size,
+				const V sad ) const
+			{
+				for (unsigned int l=0, offset=0; l<=level_max; ++l) {
+					unsigned int n = 1u << l;
+					unsigned int bs = macro_block_size >> l;
+					const V *level = crtblock + offset;
+					V bound = 0;
+					offset += n * n;
+
+					for (unsigned int iy=0; iy<n; ++iy) {
+						for (unsigned int ix=0; ix<n; ++ix) {
+							V a = level[ix + iy*n];
+							V b = presum.sum(x+ix*bs, y+iy*bs, bs, bs);
+							bound += (a > b) ? a - b : b - a;
+						}
+					}
+
+					if (bound >= sad) {
+						return true;
+					}
+				}
+
+				return false;
+			}
 		};
 
 		/**
 		 * 検出アルゴリズム three step search
+		 *
+		 * 初期ステップは探索範囲から決め、探索範囲の外の候補は評価しない
+		 * (探索範囲 7 では従来通り 4, 2, 1 の3段となる)
 		 */
 		struct three_step : public _base_search_algorithm
 		{
@@ -199,20 +703,20 @@ namespace Image
 			 * @param y マクロブロック左上 y座標
 			 * @param macro_block_size ブロックのサイズ
 			 * @param search_size ブロックの探索範囲
-			 * @param info マッチング回数
+			 * @param info 探索の統計情報
 			 * @return 動きベクトル
 			 */
-			template <typename T>
+			template <typename Ref, typename Cur>
 			ve_pair operator() (
-				const container<T> &premap,
-				const container<T> &crtmap,
+				const Ref &premap,
+				const Cur &crtmap,
 				const int x, const int y,
 				const unsigned int macro_block_size,
 				const unsigned int search_size,
-				int *info ) const
+				search_info *info ) const
 			{
 				//中心点の誤差計算
-				double sad = sum_of_absolute_difference (
+				typename sad_traits<typename Cur::value_type>::type sad = sum_of_absolute_difference (
 					crtmap, x, y,
 					premap, x, y,
 					macro_block_size
@@ -220,19 +724,34 @@ namespace Image
 				int vex = 0;
 				int vey = 0;
 				int count = 1;
+				unsigned int rows = macro_block_size;
+
+				//探索範囲を覆う最小の初期ステップ (探索範囲 7 では 4, 2, 1)
+				int step = 1;
+				while (2*step - 1 < static_cast<int>(search_size)) {
+					step <<= 1;
+				}
+
+				//画像と探索範囲からはみ出さない範囲
+				ve_pair lower, upper;
+				clip_search_range(premap, x, y, macro_block_size, search_size, &lower, &upper);
 
-				// n = 4, 2, 1 で近傍探索
-				for (int n=4; n > 0; n >>= 1) {
+				// n = step, step/2, ..., 1 で近傍探索
+				for (int n=step; n > 0; n >>= 1) {
 					int px = vex;
 					int py = vey;
 
+					//画像端を除いた n-step 8近傍セルの範囲
+					int dx_min = (px-n >= lower.first)  ? -n : 0;
+					int dx_max = (px+n <= upper.first)  ?  n : 0;
+					int dy_min = (py-n >= lower.second) ? -n : 0;
+					int dy_max = (py+n <= upper.second) ?  n : 0;
+
 					//n-step 8近傍セルと比較
-					for (int dy = -n; dy <= n; dy += n) {
-						for (int dx = -n; dx <= n; dx += n) {
-							//画像端と画像中央は処理対象外
-							if (is_over_edge(premap, x+px+dx, y+py+dy, macro_block_size)
-								|| (dy == 0 && dx == 0))
-							{
+					for (int dy = dy_min; dy <= dy_max; dy += n) {
+						for (int dx = dx_min; dx <= dx_max; dx += n) {
+							//画像中央は処理対象外
+							if (dy == 0 && dx == 0) {
 								continue;
 							}
 
@@ -240,11 +759,14 @@ namespace Image
 							++count;
 
 							//誤差計算
-							double sum = sum_of_absolute_difference (
+							unsigned int evaluated_rows;
+							auto sum = sum_of_absolute_difference (
 								crtmap, x, y,
 								premap, x+px+dx, y+py+dy,
-								macro_block_size
+								macro_block_size,
+								sad, &evaluated_rows
 							);
+							rows += evaluated_rows;
 
 							//ベクトル保存
 							if (sad > sum) {
@@ -258,18 +780,141 @@ namespace Image
 
 				//回数の保存
 				if (info != nullptr) {
-					*info = count;
+					info->match = count;
+					info->rows  = rows;
+					info->cost  = sad;
 				}
 
 				return {vex, vey};
 			}
 		};
 
+		/**
+		 * 探索パターンの1点
+		 *
+		 * @tparam X 中心からの x方向の変位
+		 * @tparam Y 中心からの y方向の変位
+		 */
+		template <int X, int Y>
+		struct point
+		{
+			enum : int { x = X, y = Y };
+		};
+
+		/**
+		 * 探索パターン
+		 *
+		 * 点の並びを型で保持し、各点の処理をコンパイル時に展開する
+		 *
+		 * @tparam Points 探索する点 (point)
+		 */
+		template <typename... Points>
+		struct pattern
+		{
+			enum : int { size = sizeof...(Points) };
+
+			/**
+			 * 全点に関数を適用 (並びの順に呼び出す)
+			 *
+			 * @param func 適用関数 func(dx, dy)
+			 */
+			template <typename F>
+			static inline
+			void for_each (F &func)
+			{
+				(void)std::initializer_list<int>{ 0, (func(Points::x, Points::y), 0)... };
+			}
+		};
+
+		/**
+		 * 評価済みの位置の記録
+		 *
+		 * 位置毎に記録した世代番号が現在の世代と一致すれば評価済みとする
+		 * 世代を進めるだけで全体を未評価に戻せるため、ブロック毎の初期化や確保は不要
+		 * 領域は大きさが足りない場合だけ確保し直す
+		 */
+		class visited_grid
+		{
+		private:
+			std::vector<unsigned int> _stamp;
+			int _size;
+			unsigned int _generation;
+
+		public:
+			visited_grid ()
+				: _size(0), _generation(0)
+			{
+			}
+
+			/**
+			 * 全位置を未評価にする
+			 *
+			 * @param size 一辺の大きさ
+			 */
+			inline
+			void reset (const int size)
+			{
+				if (_stamp.size() < static_cast<std::size_t>(size) * size) {
+					_stamp.assign(static_cast<std::size_t>(size) * size, 0);
+					_generation = 0;
+				}
+				_size = size;
+
+				//世代番号が一周したら全体を消去する
+				if (++_generation == 0) {
+					std::fill(_stamp.begin(), _stamp.end(), 0);
+					_generation = 1;
+				}
+			}
+
+			/**
+			 * 評価済みか検査
+			 */
+			inline
+			bool operator() (const int x, const int y) const
+			{
+				return _stamp[x + _size * y] == _generation;
+			}
+
+			/**
+			 * 評価済みにする
+			 */
+			inline
+			void mark (const int x, const int y)
+			{
+				_stamp[x + _size * y] = _generation;
+			}
+
+			/**
+			 * スレッド毎の作業領域の取得
+			 *
+			 * 探索の途中で別の探索を呼び出さないため、1スレッドに1つで足りる
+			 *
+			 * @return 作業領域
+			 */
+			static
+			visited_grid& local ()
+			{
+				static thread_local visited_grid grid;
+				return grid;
+			}
+		};
+
 		/**
 		 * 検出アルゴリズム ベースクラス (テンプレート検索)
+		 *
+		 * 広範囲用のパターンで最良点が中心になるまで移動し、狭範囲用のパターンで仕上げる
+		 * マクロブロック毎のヒープ確保は行わない
+		 *
+		 * @tparam Large 検索範囲テンプレート (広範囲用)
+		 * @tparam Small 検索範囲テンプレート (狭範囲用)
 		 */
+		template <typename Large, typename Small>
 		struct _shape_based_algorithm : public _base_search_algorithm
 		{
+			typedef Large large_pattern;
+			typedef Small small_pattern;
+
 			/**
 			 * @param premap 原画像
 			 * @param crtmap 次画像
@@ -277,74 +922,80 @@ namespace Image
 			 * @param y マクロブロック左上 y座標
 			 * @param macro_block_size ブロックのサイズ
 			 * @param search_size ブロックの探索範囲
-			 * @param ldsp 検索範囲テンプレート (広範囲用)
-			 * @param sdsp 検索範囲テンプレート (狭範囲用)
-			 * @param info マッチング回数
+			 * @param info 探索の統計情報
+			 * @param start 探索の開始点
+			 * @param start_sad 開始点の差分絶対値和 (最大値:未評価)
 			 * @return 動きベクトル
 			 */
-			template <typename T, typename E>
+			template <typename Ref, typename Cur>
 			ve_pair operator() (
-				const container<T> &premap,
-				const container<T> &crtmap,
+				const Ref &premap,
+				const Cur &crtmap,
 				const int x, const int y,
 				const unsigned int macro_block_size,
 				const unsigned int search_size,
-				const std::vector<std::pair<E, E>> &ldsp,
-				const std::vector<std::pair<E, E>> &sdsp,
-				int *info ) const
+				search_info *info,
+				const ve_pair &start = ve_pair(0, 0),
+				const typename sad_traits<typename Cur::value_type>::type start_sad
+					= std::numeric_limits<typename sad_traits<typename Cur::value_type>::type>::max() ) const
 			{
-				int px = 0, py = 0;
-				int vex = 0, vey = 0;
+				int px = start.first, py = start.second;
+				int vex = px, vey = py;
 				int count = 0;
+				unsigned int rows = 0;
 				int search = static_cast<int>(search_size);
 
-				container<bool> is_searched (
-					search*2+1,
-					search*2+1
-				);
+				visited_grid &is_searched = visited_grid::local();
+				is_searched.reset(search*2+1);
+
+				//画像と探索範囲からはみ出さない範囲
+				ve_pair lower, upper;
+				clip_search_range(premap, x, y, macro_block_size, search_size, &lower, &upper);
 
 				//中心点の誤差計算
-				double sad = std::numeric_limits<double>::max();
+				typedef typename sad_traits<typename Cur::value_type>::type sad_type;
+				sad_type sad = start_sad;
+
+				//評価済みの開始点は再評価しない
+				if (start_sad != std::numeric_limits<sad_type>::max()) {
+					is_searched.mark(px+search, py+search);
+				}
 
 				//主要処理を関数化
-				auto main_search_func = [&](const std::vector<std::pair<E, E>> &map) {
-					//マップ上を探索
-					for (auto i = map.begin(); i != map.end(); ++i) {
-						int dx = i->first;
-						int dy = i->second;
-
-						//画像端と処理済みは処理対象外
-						if (is_over_edge(premap, x+px+dx, y+py+dy, macro_block_size)
-							|| (px+dx+search) < 0 || (px+dx+search) > 2*search
-							|| (py+dy+search) < 0 || (py+dy+search) > 2*search 
-							|| is_searched(px+dx+search, py+dy+search))
-						{
-							continue;
-						}
+				auto main_search_func = [&](const int dx, const int dy) {
+					//範囲外と処理済みは処理対象外
+					if ((px+dx) < lower.first || (px+dx) > upper.first
+						|| (py+dy) < lower.second || (py+dy) > upper.second
+						|| is_searched(px+dx+search, py+dy+search))
+					{
+						return;
+					}
 
-						//回数のカウント
-						++count;
+					//回数のカウント
+					++count;
 
-						//誤差計算
-						double sum = sum_of_absolute_difference (
-							crtmap, x, y,
-							premap, x+px+dx, y+py+dy,
-							macro_block_size
-						);
-						is_searched(px+dx+search, py+dy+search) = true;
+					//誤差計算
+					unsigned int n;
+					auto sum = sum_of_absolute_difference (
+						crtmap, x, y,
+						premap, x+px+dx, y+py+dy,
+						macro_block_size,
+						sad, &n
+					);
+					rows += n;
+					is_searched.mark(px+dx+search, py+dy+search);
 
-						//ベクトル保存
-						if (sad > sum) {
-							sad = sum;
-							vex = px+dx;
-							vey = py+dy;
-						}
+					//ベクトル保存
+					if (sad > sum) {
+						sad = sum;
+						vex = px+dx;
+						vey = py+dy;
 					}
 				};
 
 				//LDSP上を検索
 				while (true) {
-					main_search_func(ldsp);
+					Large::for_each(main_search_func);
 
 					if (px == vex && py == vey) {
 						break;
@@ -356,11 +1007,13 @@ namespace Image
 				}
 
 				//SDSP上を検索
-				main_search_func(sdsp);
+				Small::for_each(main_search_func);
 
 				//回数の保存
 				if (info != nullptr) {
-					*info = count;
+					info->match = count;
+					info->rows  = rows;
+					info->cost  = sad;
 				}
 
 				return {vex, vey};
@@ -370,8 +1023,67 @@ namespace Image
 		/**
 		 * 検出アルゴリズム greedy search
 		 */
-		struct greedy : public _shape_based_algorithm
+		struct greedy : public _shape_based_algorithm<
+			pattern<
+				point<-1,-1>, point< 0,-1>, point< 1,-1>,
+				point<-1, 0>, point< 0, 0>, point< 1, 0>,
+				point<-1, 1>, point< 0, 1>, point< 1, 1> >,
+			pattern<> >
+		{
+		};
+
+		/**
+		 * 検出アルゴリズム diamond search
+		 */
+		struct diamond : public _shape_based_algorithm<
+			pattern<
+				point<-2, 0>, point<-1, 1>, point< 0, 2>, point< 1, 1>, point<0, 0>,
+				point< 2, 0>, point< 1,-1>, point< 0,-2>, point<-1,-1> >,
+			pattern<
+				point<-1, 0>, point< 0, 1>, point< 1, 0>, point< 0,-1>, point<0, 0> > >
+		{
+		};
+
+		/**
+		 * 検出アルゴリズム hexagon based search
+		 */
+		struct hexagon : public _shape_based_algorithm<
+			pattern<
+				point<-2, 0>, point<-1, 2>, point< 1, 2>, point<0, 0>,
+				point< 2, 0>, point< 1,-2>, point<-1,-2> >,
+			pattern<
+				point<-1, 0>, point< 0, 1>, point< 1, 0>, point< 0,-1>, point<0, 0> > >
 		{
+		};
+
+
+		/**
+		 * 検出アルゴリズム predictive search (EPZS)
+		 *
+		 * 周囲のブロック (左・上・右上) の動きベクトルの中央値、
+		 * 前フレームの同じ位置の動きベクトル、ゼロベクトルを予測候補として評価し、
+		 * 最良の候補を開始点として Search (diamond / hexagon) で補正する
+		 * 最良の候補の差分絶対値和が閾値以下であれば補正を省略する
+		 * 閾値は周囲のブロックの差分絶対値和から適応的に決める
+		 * 周囲のブロックの結果を参照するため、並列実行時は波面状に処理される
+		 */
+		template <typename Search>
+		struct predictive : public Search
+		{
+			typedef void causal_search;
+
+			//前フレームの動きベクトル (nullptr:使用しない)
+			const ve_container *previous;
+
+			/**
+			 * @param previous 前フレームの動きベクトル
+			 * @param search 補正に用いる検出アルゴリズム
+			 */
+			explicit predictive (const ve_container *previous = nullptr, const Search &search = Search())
+				: Search(search), previous(previous)
+			{
+			}
+
 			/**
 			 * @param premap 原画像
 			 * @param crtmap 次画像
@@ -379,38 +1091,181 @@ namespace Image
 			 * @param y マクロブロック左上 y座標
 			 * @param macro_block_size ブロックのサイズ
 			 * @param search_size ブロックの探索範囲
-			 * @param info マッチング回数
+			 * @param info 探索の統計情報
+			 * @param current 探索済みの動きベクトル
+			 * @param stats 探索済みブロックの統計情報
 			 * @return 動きベクトル
 			 */
-			template <typename T>
+			template <typename Ref, typename Cur>
 			ve_pair operator() (
-				const container<T> &premap,
-				const container<T> &crtmap,
+				const Ref &premap,
+				const Cur &crtmap,
 				const int x, const int y,
 				const unsigned int macro_block_size,
 				const unsigned int search_size,
-				int *info ) const
+				search_info *info,
+				const ve_container &current,
+				const container<search_info> &stats ) const
 			{
-				std::vector<ve_pair> ldsp = {
-					{-1,-1}, { 0,-1}, { 1,-1},
-					{-1, 0}, { 0, 0}, { 1, 0},
-					{-1, 1}, { 0, 1}, { 1, 1}
+				typedef typename sad_traits<typename Cur::value_type>::type sad_type;
+
+				int mx = x / macro_block_size;
+				int my = y / macro_block_size;
+				int search = static_cast<int>(search_size);
+
+				//予測候補
+				ve_pair candidate[3];
+				int n = 0;
+				candidate[n++] = median(current, mx, my);
+				if (previous != nullptr
+					&& previous->width() == current.width()
+					&& previous->height() == current.height())
+				{
+					candidate[n++] = (*previous)(mx, my);
+				}
+				candidate[n++] = ve_pair(0, 0);
+
+				sad_type sad = std::numeric_limits<sad_type>::max();
+				ve_pair ve(0, 0);
+				int count = 0;
+				unsigned int rows = 0;
+
+				for (int i=0; i<n; ++i) {
+					//探索範囲内に丸める
+					int dx = std::max(-search, std::min(search, candidate[i].first));
+					int dy = std::max(-search, std::min(search, candidate[i].second));
+					candidate[i] = ve_pair(dx, dy);
+
+					//画像端と評価済みは処理対象外
+					if (this->is_over_edge(premap, x+dx, y+dy, macro_block_size)
+						|| std::find(candidate, candidate+i, candidate[i]) != candidate+i)
+					{
+						continue;
+					}
+
+					//回数のカウント
+					++count;
+
+					//誤差計算
+					unsigned int r;
+					auto sum = this->sum_of_absolute_difference (
+						crtmap, x, y,
+						premap, x+dx, y+dy,
+						macro_block_size,
+						sad, &r
+					);
+					rows += r;
+
+					//ベクトル保存
+					if (sad > sum) {
+						sad = sum;
+						ve = candidate[i];
+					}
+				}
+
+				//予測が十分に良ければ補正しない
+				if (sad > threshold(stats, mx, my, macro_block_size)) {
+					search_info refine;
+					ve = Search::operator() (
+						premap, crtmap, x, y,
+						macro_block_size, search_size,
+						&refine, ve, sad
+					);
+					count += refine.match;
+					rows  += refine.rows;
+					sad    = refine.cost;
+				}
+
+				//回数の保存
+				if (info != nullptr) {
+					info->match = count;
+					info->rows  = rows;
+					info->cost  = sad;
+				}
+
+				return ve;
+			}
+
+		private:
+			/**
+			 * 周囲のブロックの動きベクトルの中央値
+			 *
+			 * 右上が無い場合は左上で代用し、先頭行は左の動きベクトルを用いる
+			 */
+			static ve_pair median (const ve_container &current, const int mx, const int my)
+			{
+				ve_pair left = (mx > 0) ? current(mx-1, my) : ve_pair(0, 0);
+				if (my == 0) {
+					return left;
+				}
+
+				ve_pair top = current(mx, my-1);
+				ve_pair corner =
+					(mx+1 < current.width()) ? current(mx+1, my-1) :
+					(mx > 0)                 ? current(mx-1, my-1) : ve_pair(0, 0);
+
+				auto mid = [](int a, int b, int c) {
+					return std::max(std::min(a, b), std::min(std::max(a, b), c));
 				};
-				std::vector<ve_pair> sdsp = {};
+				return {
+					mid(left.first,  top.first,  corner.first),
+					mid(left.second, top.second, corner.second)
+				};
+			}
 
-				return _shape_based_algorithm::operator() (
-					premap, crtmap, x, y,
-					macro_block_size, search_size,
-					ldsp, sdsp, info
-				);
+			/**
+			 * 補正を省略する閾値
+			 *
+			 * 周囲のブロックの差分絶対値和の最小値の 9/8 倍とし、
+			 * 1画素当たり 1 から 4 の範囲に収める
+			 */
+			static double threshold (
+				const container<search_info> &stats,
+				const int mx, const int my,
+				const unsigned int macro_block_size )
+			{
+				double area = static_cast<double>(macro_block_size) * macro_block_size;
+				double cost = std::numeric_limits<double>::max();
+
+				if (mx > 0) {
+					cost = std::min(cost, stats(mx-1, my).cost);
+				}
+				if (my > 0) {
+					cost = std::min(cost, stats(mx, my-1).cost);
+					if (mx+1 < stats.width()) {
+						cost = std::min(cost, stats(mx+1, my-1).cost);
+					}
+				}
+
+				if (cost == std::numeric_limits<double>::max()) {
+					return area;
+				}
+				return std::max(area, std::min(4 * area, cost * 9 / 8));
 			}
 		};
 
 		/**
-		 * 検出アルゴリズム diamond search
+		 * 検出アルゴリズム hierarchical search (画像ピラミッド)
+		 *
+		 * 縦横 1/2^levels に縮小した画像で全探索し、
+		 * 1段ずつ拡大しながら動きベクトルを ±1 画素の範囲で補正する
+		 * 画像ピラミッドはフレーム毎に一度だけ作成され、
+		 * フレームが次の組の元画像になっても再利用される
 		 */
-		struct diamond : public _shape_based_algorithm
+		struct hierarchical : public _base_search_algorithm
 		{
+			unsigned int levels;
+			bool unrestricted;
+
+			/**
+			 * @param levels 縮小する段数
+			 * @param unrestricted 画像外の動きベクトルを許す
+			 */
+			explicit hierarchical (unsigned int levels = 2, bool unrestricted = false)
+				: levels(levels), unrestricted(unrestricted)
+			{
+			}
+
 			/**
 			 * @param premap 原画像
 			 * @param crtmap 次画像
@@ -418,39 +1273,168 @@ namespace Image
 			 * @param y マクロブロック左上 y座標
 			 * @param macro_block_size ブロックのサイズ
 			 * @param search_size ブロックの探索範囲
-			 * @param info マッチング回数
+			 * @param info 探索の統計情報
 			 * @return 動きベクトル
 			 */
 			template <typename T>
 			ve_pair operator() (
-				const container<T> &premap,
-				const container<T> &crtmap,
+				const frame<T> &premap,
+				const frame<T> &crtmap,
 				const int x, const int y,
 				const unsigned int macro_block_size,
 				const unsigned int search_size,
-				int *info ) const
+				search_info *info ) const
 			{
-				std::vector<ve_pair> ldsp = {
-					{-2, 0}, {-1, 1}, { 0, 2}, { 1, 1}, {0, 0},
-					{ 2, 0}, { 1,-1}, { 0,-2}, {-1,-1}
-				};
-				std::vector<ve_pair> sdsp = {
-					{-1, 0}, { 0, 1}, { 1, 0}, { 0,-1}, {0, 0}
-				};
+				//ブロックが2画素以上かつ等分できる段数まで
+				unsigned int top = 0;
+				while (top < levels
+					&& (macro_block_size >> (top+1)) >= 2
+					&& macro_block_size % (2u << top) == 0)
+				{
+					++top;
+				}
 
-				return _shape_based_algorithm::operator() (
-					premap, crtmap, x, y,
-					macro_block_size, search_size,
-					ldsp, sdsp, info
-				);
+				ve_pair ve(0, 0);
+				int count = 0;
+				unsigned int rows = 0;
+				double sad = 0;
+
+				for (int l = top; l >= 0; --l) {
+					const frame<T> &pre = premap.pyramid(l);
+					const frame<T> &crt = crtmap.pyramid(l);
+					unsigned int bs = macro_block_size >> l;
+					//各段の探索範囲 (元画像の探索範囲に相当)
+					unsigned int limit = (search_size + (1u << l) - 1) >> l;
+
+					//最上段は全探索、以降は前段のベクトルの周囲を探索
+					unsigned int range = limit;
+					if (l != static_cast<int>(top)) {
+						ve.first  *= 2;
+						ve.second *= 2;
+						range = 1;
+					}
+
+					if (unrestricted) {
+						ve = search_level(pre.padded(bs + limit), crt, x >> l, y >> l,
+						                  bs, ve, range, limit, &count, &rows, &sad);
+					}
+					else {
+						ve = search_level(pre, crt, x >> l, y >> l,
+						                  bs, ve, range, limit, &count, &rows, &sad);
+					}
+				}
+
+				//回数の保存
+				if (info != nullptr) {
+					info->match = count;
+					info->rows  = rows;
+					info->cost  = sad;
+				}
+
+				return ve;
+			}
+
+		private:
+			/**
+			 * 1段分の探索
+			 *
+			 * @param premap 原画像 (各段)
+			 * @param crtmap 次画像 (各段)
+			 * @param x マクロブロック左上 x座標
+			 * @param y マクロブロック左上 y座標
+			 * @param macro_block_size ブロックのサイズ
+			 * @param center 探索の中心
+			 * @param range 中心からの探索範囲
+			 * @param limit 原点からの探索範囲
+			 * @param count マッチング回数の累積先
+			 * @param rows 評価行数の累積先
+			 * @param cost 差分絶対値和の保存先
+			 * @return 動きベクトル
+			 */
+			template <typename Ref, typename Cur>
+			ve_pair search_level (
+				const Ref &premap,
+				const Cur &crtmap,
+				const int x, const int y,
+				const unsigned int macro_block_size,
+				const ve_pair center,
+				const unsigned int range,
+				const unsigned int limit,
+				int *count, unsigned int *rows, double *cost ) const
+			{
+				typedef typename sad_traits<typename Cur::value_type>::type sad_type;
+				sad_type sad = std::numeric_limits<sad_type>::max();
+				ve_pair ve = center;
+				int r = static_cast<int>(range);
+
+				ve_pair lower, upper;
+				clip_search_range(premap, x, y, macro_block_size, limit, &lower, &upper);
+
+				for (int dy = std::max(lower.second, center.second - r);
+				     dy <= std::min(upper.second, center.second + r); ++dy)
+				{
+					for (int dx = std::max(lower.first, center.first - r);
+					     dx <= std::min(upper.first, center.first + r); ++dx)
+					{
+						//回数カウント
+						++*count;
+
+						//誤差計算
+						unsigned int n;
+						auto sum = sum_of_absolute_difference (
+							crtmap, x, y,
+							premap, x+dx, y+dy,
+							macro_block_size,
+							sad, &n
+						);
+						*rows += n;
+
+						//ベクトル保存
+						if (sad > sum) {
+							sad = sum;
+							ve = ve_pair(dx, dy);
+						}
+					}
+				}
+
+				*cost = sad;
+				return ve;
 			}
 		};
 
 		/**
-		 * 検出アルゴリズム hexagon based search
+		 * 画像外の動きベクトルを許す探索
+		 *
+		 * 元画像を search_size + macro_block_size 画素拡張した画像を
+		 * 参照画像として検出アルゴリズム Search を実行する
+		 * 拡張画像はフレーム毎に一度だけ作成されるため、候補毎の画像端の検査が不要になる
+		 * 予測画像の作成には同じ拡張画像を用いる
 		 */
-		struct hexagon : public _shape_based_algorithm
+		template <typename Search>
+		struct unrestricted : public Search
 		{
+			/**
+			 * @param search 検出アルゴリズム
+			 */
+			unrestricted (const Search &search = Search())
+				: Search(search)
+			{
+			}
+
+			/**
+			 * 拡張画素数
+			 *
+			 * @param macro_block_size ブロックのサイズ
+			 * @param search_size ブロックの探索範囲
+			 * @return 参照画像の拡張画素数
+			 */
+			static unsigned int margin (
+				const unsigned int macro_block_size,
+				const unsigned int search_size )
+			{
+				return macro_block_size + search_size;
+			}
+
 			/**
 			 * @param premap 原画像
 			 * @param crtmap 次画像
@@ -458,34 +1442,82 @@ namespace Image
 			 * @param y マクロブロック左上 y座標
 			 * @param macro_block_size ブロックのサイズ
 			 * @param search_size ブロックの探索範囲
-			 * @param info マッチング回数
+			 * @param args 検出アルゴリズムへ渡す残りの引数
 			 * @return 動きベクトル
 			 */
-			template <typename T>
+			template <typename T, typename... Args>
 			ve_pair operator() (
-				const container<T> &premap,
-				const container<T> &crtmap,
+				const frame<T> &premap,
+				const frame<T> &crtmap,
 				const int x, const int y,
 				const unsigned int macro_block_size,
 				const unsigned int search_size,
-				int *info ) const
+				Args&&... args ) const
 			{
-				std::vector<ve_pair> ldsp = {
-					{-2, 0}, {-1, 2}, { 1, 2}, {0, 0},
-					{ 2, 0}, { 1,-2}, {-1,-2}
-				};
-				std::vector<ve_pair> sdsp = {
-					{-1, 0}, { 0, 1}, { 1, 0}, { 0,-1}, {0, 0}
-				};
-
-				return _shape_based_algorithm::operator() (
-					premap, crtmap, x, y,
-					macro_block_size, search_size,
-					ldsp, sdsp, info
+				return Search::operator() (
+					premap.padded(margin(macro_block_size, search_size)), crtmap,
+					x, y, macro_block_size, search_size, std::forward<Args>(args)...
 				);
 			}
 		};
 
+
+		/**
+		 * 画像外の動きベクトルを許す探索 (hierarchical search)
+		 *
+		 * 画像ピラミッドの各段で拡張画像を参照する
+		 */
+		template <>
+		struct unrestricted<hierarchical> : public hierarchical
+		{
+			/**
+			 * @param search 検出アルゴリズム
+			 */
+			unrestricted (const hierarchical &search = hierarchical())
+				: hierarchical(search.levels, true)
+			{
+			}
+
+			/**
+			 * 拡張画素数
+			 *
+			 * @param macro_block_size ブロックのサイズ
+			 * @param search_size ブロックの探索範囲
+			 * @return 参照画像 (原寸) の拡張画素数
+			 */
+			static unsigned int margin (
+				const unsigned int macro_block_size,
+				const unsigned int search_size )
+			{
+				return macro_block_size + search_size;
+			}
+		};
+
+		/**
+		 * 前フレームの動きベクトルの設定
+		 *
+		 * 前フレームの結果を参照しない検出アルゴリズムはそのまま返す
+		 *
+		 * @param search 検出アルゴリズム
+		 * @param previous 前フレームの動きベクトル
+		 * @return 設定した検出アルゴリズム
+		 */
+		template <typename Search>
+		inline
+		Search with_previous (const Search &search, const ve_container * /*previous*/)
+		{
+			return search;
+		}
+
+		template <typename Search>
+		inline
+		predictive<Search> with_previous (const predictive<Search> &search, const ve_container *previous)
+		{
+			predictive<Search> ret = search;
+			ret.previous = previous;
+			return ret;
+		}
+
 	}
 }
 
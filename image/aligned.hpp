@@ -0,0 +1,112 @@
+#ifndef _IMAGE_ALIGNED_
+#define _IMAGE_ALIGNED_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <limits>
+#include <utility>
+
+namespace Image
+{
+	/**
+	 * 境界を揃えて確保するアロケータ
+	 *
+	 * SIMD のアラインロードで読めるよう、先頭を Align バイト境界に揃える
+	 *
+	 * @tparam T 要素の型
+	 * @tparam Align 境界のバイト数 (2の累乗かつ sizeof(void*) の倍数)
+	 */
+	template <typename T, std::size_t Align = 64>
+	class aligned_allocator
+	{
+	public:
+		typedef T value_type;
+		typedef T* pointer;
+		typedef const T* const_pointer;
+		typedef T& reference;
+		typedef const T& const_reference;
+		typedef std::size_t size_type;
+		typedef std::ptrdiff_t difference_type;
+
+		static const std::size_t alignment = Align;
+
+		template <typename U>
+		struct rebind
+		{
+			typedef aligned_allocator<U, Align> other;
+		};
+
+		aligned_allocator ()
+		{
+		}
+
+		template <typename U>
+		aligned_allocator (const aligned_allocator<U, Align>&)
+		{
+		}
+
+		/**
+		 * 領域の確保
+		 *
+		 * @param n 要素数
+		 * @return 先頭 (Align バイト境界)
+		 */
+		T* allocate (const std::size_t n)
+		{
+			if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+				throw std::bad_alloc();
+			}
+
+			void *p = nullptr;
+			if (::posix_memalign(&p, Align, n * sizeof(T)) != 0) {
+				throw std::bad_alloc();
+			}
+			return static_cast<T*>(p);
+		}
+
+		/**
+		 * 領域の解放
+		 *
+		 * @param p 先頭
+		 */
+		void deallocate (T *p, const std::size_t)
+		{
+			std::free(p);
+		}
+
+		std::size_t max_size () const
+		{
+			return std::numeric_limits<std::size_t>::max() / sizeof(T);
+		}
+
+		template <typename U, typename... Args>
+		void construct (U *p, Args&&... args)
+		{
+			::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+		}
+
+		template <typename U>
+		void destroy (U *p)
+		{
+			p->~U();
+		}
+	};
+
+	template <typename T, typename U, std::size_t Align>
+	inline
+	bool operator== (const aligned_allocator<T, Align>&, const aligned_allocator<U, Align>&)
+	{
+		return true;
+	}
+
+	template <typename T, typename U, std::size_t Align>
+	inline
+	bool operator!= (const aligned_allocator<T, Align>&, const aligned_allocator<U, Align>&)
+	{
+		return false;
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
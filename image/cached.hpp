@@ -0,0 +1,87 @@
+#ifndef _IMAGE_CACHED_
+#define _IMAGE_CACHED_
+
+#include <memory>
+#include <mutex>
+#include <map>
+
+namespace Image
+{
+	/**
+	 * 遅延生成される派生データ
+	 *
+	 * キー毎に初回参照時に一度だけ生成し、以降は同じデータを返す
+	 * 複数スレッドから同時に参照してもよい
+	 * 複製時は派生データを引き継がず、移動時は引き継ぐ
+	 */
+	template <typename V, typename Key = unsigned int>
+	class cached
+	{
+	private:
+		std::unique_ptr<std::mutex> _mutex;
+		mutable std::map<Key, std::shared_ptr<const V>> _values;
+
+	public:
+		cached ()
+			: _mutex(new std::mutex)
+		{
+		}
+
+		cached (const cached &)
+			: _mutex(new std::mutex)
+		{
+		}
+
+		cached (cached &&obj)
+			: _mutex(new std::mutex), _values(std::move(obj._values))
+		{
+		}
+
+		cached& operator= (const cached &)
+		{
+			std::lock_guard<std::mutex> lock(*_mutex);
+			_values.clear();
+			return *this;
+		}
+
+		cached& operator= (cached &&obj)
+		{
+			std::lock_guard<std::mutex> lock(*_mutex);
+			_values = std::move(obj._values);
+			return *this;
+		}
+
+		/**
+		 * 派生データの取得
+		 *
+		 * @param key 派生データのキー
+		 * @param build 未生成の場合に呼び出す生成関数
+		 * @return 派生データ
+		 */
+		template <typename Builder>
+		const V& get (const Key &key, Builder build) const
+		{
+			std::lock_guard<std::mutex> lock(*_mutex);
+			auto &value = _values[key];
+			if (!value) {
+				value = std::make_shared<const V>(build());
+			}
+			return *value;
+		}
+
+		/**
+		 * 派生データの取得 (キーなし)
+		 *
+		 * @param build 未生成の場合に呼び出す生成関数
+		 * @return 派生データ
+		 */
+		template <typename Builder>
+		const V& get (Builder build) const
+		{
+			return get(Key(), build);
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -2,22 +2,30 @@
 #define _IMAGE_CONTAINER_
 
 #include <vector>
+#include <algorithm>
 #include <cassert>
 
+#include "aligned.hpp"
+#include "expression.hpp"
+
 namespace Image
 {
 
 	/**
 	 * 画像のコンテナクラス
+	 *
+	 * 先頭は64バイト境界に揃える
+	 * 行ピッチ (stride) を指定すると各行の末尾に余白を置き、行の先頭も境界に揃えられる
 	 */
 	template <
 		typename T ,
-		typename ContainerType = std::vector<T> >
+		typename ContainerType = std::vector<T, aligned_allocator<T>> >
 	class container
 	{
 	private:
 		unsigned int _width;
 		unsigned int _height;
+		unsigned int _stride;
 		ContainerType _image;
 
 	public:
@@ -32,7 +40,7 @@ namespace Image
 		 *
 		 */
 		container ()
-			: _width(0), _height(0), _image()
+			: _width(0), _height(0), _stride(0), _image()
 		{
 		}
 
@@ -43,8 +51,23 @@ namespace Image
 		 * @param height コンテナの縦幅
 		 */
 		container (unsigned int width, unsigned int height)
-			: _width(width), _height(height), _image(width * height)
+			: _width(width), _height(height), _stride(width), _image(width * height)
+		{
+		}
+
+		/**
+		 * 行ピッチを指定したコンストラクタ
+		 *
+		 * 行の余白を含めて stride * height 要素を確保する
+		 *
+		 * @param width コンテナの横幅
+		 * @param height コンテナの縦幅
+		 * @param stride 1行あたりの要素数 (width 以上)
+		 */
+		container (unsigned int width, unsigned int height, unsigned int stride)
+			: _width(width), _height(height), _stride(stride), _image(stride * height)
 		{
+			assert(stride >= width);
 		}
 
 		/**
@@ -57,9 +80,42 @@ namespace Image
 		 */
 		template <typename Iterator>
 		container (int width, int height, Iterator start, Iterator end)
-			: _width(width), _height(height), _image(start, end)
+			: _width(width), _height(height), _stride(width), _image(start, end)
 		{
-			assert(width * height == _image.size());
+			assert(static_cast<std::size_t>(width) * height == _image.size());
+		}
+
+		/**
+		 * 式の評価による作成
+		 *
+		 * @param e 式
+		 */
+		template <typename E>
+		container (const expression::node<E> &e)
+			: _width(e.self().width()), _height(e.self().height()), _stride(_width), _image(_width * _height)
+		{
+			expression::evaluate(e, _image.data(), _stride);
+		}
+
+		/**
+		 * 式の代入
+		 *
+		 * 大きさが異なる場合は作り直す (行ピッチは横幅になる)
+		 * 同じ位置の画素だけを参照するため、自身を含む式を代入してもよい
+		 *
+		 * @param e 式
+		 * @return 自身の参照
+		 */
+		template <typename E>
+		container& operator= (const expression::node<E> &e)
+		{
+			const E &expr = e.self();
+			if (static_cast<int>(_width) != expr.width() || static_cast<int>(_height) != expr.height()) {
+				*this = container(e);
+				return *this;
+			}
+			expression::evaluate(e, _image.data(), _stride);
+			return *this;
 		}
 
 		/**
@@ -84,16 +140,58 @@ namespace Image
 			return _height;
 		}
 
+		/**
+		 * 行ピッチの取得
+		 *
+		 * @return 1行あたりの要素数
+		 */
+		inline
+		int stride () const
+		{
+			return _stride;
+		}
+
+		/**
+		 * 境界に揃えた行ピッチの計算
+		 *
+		 * @param width 横幅
+		 * @param alignment 行の先頭を揃えるバイト数 (32 または 64)
+		 * @return 1行あたりの要素数
+		 */
+		static
+		unsigned int aligned_stride (const unsigned int width, const unsigned int alignment = 64)
+		{
+			unsigned int bytes = (width * sizeof(T) + alignment - 1) / alignment * alignment;
+			return (bytes % sizeof(T) == 0) ? bytes / sizeof(T) : width;
+		}
+
 		/**
 		 * コンテナの等価評価
 		 *
+		 * 行の余白は比較しない
+		 *
 		 * @param obj コンテナ
 		 * @return ture:等価
 		 */
 		inline
 		bool operator== (const container &obj) const
 		{
-			return _image == obj._image;
+			if (_width != obj._width || _height != obj._height) {
+				return false;
+			}
+			if (_stride == obj._stride) {
+				return _image == obj._image;
+			}
+			for (unsigned int y = 0; y < _height; ++y) {
+				if (!std::equal(
+						_image.begin() + y * _stride,
+						_image.begin() + y * _stride + _width,
+						obj._image.begin() + y * obj._stride ))
+				{
+					return false;
+				}
+			}
+			return true;
 		}
 
 		/**
@@ -108,7 +206,7 @@ namespace Image
 		operator() (unsigned int x, unsigned int y) const
 		{
 			assert(x < _width && y < _height);
-			return _image[x + _width * y];
+			return _image[x + _stride * y];
 		}
 
 		/**
@@ -123,56 +221,42 @@ namespace Image
 		operator() (unsigned int x, unsigned int y)
 		{
 			assert(x < _width && y < _height);
-			return _image[x + _width * y];
+			return _image[x + _stride * y];
 		}
 
 		/**
 		 * 加算
 		 *
 		 * @param obj コンテナ
-		 * @return 加算結果
+		 * @return 加算する式 (代入時に評価する)
 		 */
 		inline
-		container operator+ (const container &obj) const
+		expression::binary<expression::terminal<T>, expression::terminal<T>, expression::plus>
+		operator+ (const container &obj) const
 		{
 			assert(_width == obj._width && _height == obj._height);
-
-			auto tmp = *this;
-			auto it = tmp._image.begin();
-			auto cit = obj._image.begin();
-
-			for ( ; it != tmp._image.end(); ++it, ++cit) {
-				*it += *cit;
-			}
-
-			return tmp;
+			return expression::make_binary<expression::plus>(*this, obj);
 		}
 
 		/**
 		 * 減算
 		 *
 		 * @param obj コンテナ
-		 * @return 減算結果
+		 * @return 減算する式 (代入時に評価する)
 		 */
 		inline
-		container operator- (const container &obj) const
+		expression::binary<expression::terminal<T>, expression::terminal<T>, expression::minus>
+		operator- (const container &obj) const
 		{
 			assert(_width == obj._width && _height == obj._height);
-
-			auto tmp = *this;
-			auto it = tmp._image.begin();
-			auto cit = obj._image.begin();
-
-			for ( ; it != tmp._image.end(); ++it, ++cit) {
-				*it -= *cit;
-			}
-
-			return tmp;
+			return expression::make_binary<expression::minus>(*this, obj);
 		}
 
 		/**
 		 * 要素参照イテレータの取得
 		 *
+		 * 行ピッチを指定した場合は行の余白も含む
+		 *
 		 * @return 先頭イテレータ
 		 */
 		inline
@@ -196,19 +280,13 @@ namespace Image
 		 * 全要素に関数を適用
 		 *
 		 * @param func 適用関数
-		 * @return 適用結果
+		 * @return 適用する式 (代入時に評価する)
 		 */
 		template <typename P>
 		inline
-		container apply (P func) const
+		expression::unary<expression::terminal<T>, P> apply (P func) const
 		{
-			auto tmp = *this;
-
-			for (auto it = tmp._image.begin() ; it != tmp._image.end(); ++it) {
-				*it = func(*it);
-			}
-
-			return tmp;
+			return expression::terminal<T>(*this).apply(func);
 		}
 
 		/**
@@ -224,6 +302,21 @@ namespace Image
 			unsigned int dx, unsigned int dy );
 
 	};
+
+	/**
+	 * 式の評価
+	 *
+	 * auto で受ける場合など、式をその場でコンテナにする
+	 *
+	 * @param e 式
+	 * @return 評価結果
+	 */
+	template <typename E>
+	inline
+	container<typename E::value_type> evaluate (const expression::node<E> &e)
+	{
+		return container<typename E::value_type>(e);
+	}
 };
 
 namespace std
@@ -253,14 +346,14 @@ namespace std
 		assert(sx + sw <= src._width && sy + sh <= src._height);
 		assert(dx + sw <= dst._width && dy + sh <= dst._height);
 
-		int sp = sx + sy * src._width;
-		int dp = dx + dy * dst._width;
+		int sp = sx + sy * src._stride;
+		int dp = dx + dy * dst._stride;
 
-		for (int i = 0; i < sh; ++i) {
+		for (unsigned int i = 0; i < sh; ++i) {
 			std::copy(
-				src._image.begin() + sp+i*src._width,
-				src._image.begin() + sp+i*src._width + sw,
-				dst._image.begin() + dp+i*dst._width );
+				src._image.begin() + sp+i*src._stride,
+				src._image.begin() + sp+i*src._stride + sw,
+				dst._image.begin() + dp+i*dst._stride );
 		}
 
 		return dst;
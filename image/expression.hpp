@@ -0,0 +1,368 @@
+#ifndef _IMAGE_EXPRESSION_
+#define _IMAGE_EXPRESSION_
+
+#include <utility>
+#include <type_traits>
+#include <cassert>
+
+namespace Image
+{
+	/**
+	 * 画像の式テンプレート
+	 *
+	 * 画素毎の演算を式の木として保持し、コンテナへの代入や総和の計算時に
+	 * 1回のループでまとめて評価する (途中の画像を作らない)
+	 * 式は元の画像を参照するため、評価するまで元の画像を破棄してはならない
+	 */
+	namespace expression
+	{
+		/**
+		 * 式の共通基底 (型判定用)
+		 */
+		struct base
+		{
+		};
+
+		template <typename E, typename F>
+		class unary;
+
+		/**
+		 * 式の基底クラス
+		 *
+		 * @tparam E 派生クラス
+		 */
+		template <typename E>
+		class node : public base
+		{
+		public:
+			/**
+			 * 派生クラスの取得
+			 */
+			inline
+			const E& self () const
+			{
+				return static_cast<const E&>(*this);
+			}
+
+			/**
+			 * 全要素に関数を適用
+			 *
+			 * @param func 適用関数
+			 * @return 適用する式
+			 */
+			template <typename P>
+			inline
+			unary<E, P> apply (P func) const
+			{
+				return unary<E, P>(self(), func);
+			}
+		};
+
+		/**
+		 * 式の判定
+		 */
+		template <typename E>
+		struct is_expression
+			: std::is_base_of<base, typename std::decay<E>::type>
+		{
+		};
+
+		/**
+		 * 画像の参照 (式の葉)
+		 *
+		 * 画素を先頭ポインタと行ピッチで参照する
+		 *
+		 * @tparam T 画素の型
+		 */
+		template <typename T>
+		class terminal : public node<terminal<T>>
+		{
+		private:
+			const T *_data;
+			int _width;
+			int _height;
+			int _stride;
+
+		public:
+			typedef T value_type;
+
+			/**
+			 * コンストラクタ
+			 *
+			 * @param map 参照する画像
+			 */
+			template <typename Map>
+			explicit terminal (const Map &map)
+				: _data((map.width() > 0 && map.height() > 0) ? &map(0, 0) : nullptr),
+				  _width(map.width()), _height(map.height()), _stride(map.stride())
+			{
+			}
+
+			inline
+			int width () const
+			{
+				return _width;
+			}
+
+			inline
+			int height () const
+			{
+				return _height;
+			}
+
+			inline
+			const T& operator() (const int x, const int y) const
+			{
+				return _data[x + _stride * y];
+			}
+		};
+
+		/**
+		 * 1項演算
+		 *
+		 * @tparam E 演算対象の式
+		 * @tparam F 演算関数
+		 */
+		template <typename E, typename F>
+		class unary : public node<unary<E, F>>
+		{
+		private:
+			E _e;
+			F _func;
+
+		public:
+			typedef typename std::decay<
+				decltype(std::declval<const F&>()(std::declval<typename E::value_type>()))>::type value_type;
+
+			unary (const E &e, const F &func)
+				: _e(e), _func(func)
+			{
+			}
+
+			inline
+			int width () const
+			{
+				return _e.width();
+			}
+
+			inline
+			int height () const
+			{
+				return _e.height();
+			}
+
+			inline
+			value_type operator() (const int x, const int y) const
+			{
+				return _func(_e(x, y));
+			}
+		};
+
+		/**
+		 * 2項演算
+		 *
+		 * @tparam L 左辺の式
+		 * @tparam R 右辺の式
+		 * @tparam F 演算関数
+		 */
+		template <typename L, typename R, typename F>
+		class binary : public node<binary<L, R, F>>
+		{
+		private:
+			L _l;
+			R _r;
+			F _func;
+
+		public:
+			typedef typename std::decay<
+				decltype(std::declval<const F&>()(
+					std::declval<typename L::value_type>(),
+					std::declval<typename R::value_type>()))>::type value_type;
+
+			binary (const L &l, const R &r, const F &func = F())
+				: _l(l), _r(r), _func(func)
+			{
+				assert(l.width() == r.width() && l.height() == r.height());
+			}
+
+			inline
+			int width () const
+			{
+				return _l.width();
+			}
+
+			inline
+			int height () const
+			{
+				return _l.height();
+			}
+
+			inline
+			value_type operator() (const int x, const int y) const
+			{
+				return _func(_l(x, y), _r(x, y));
+			}
+		};
+
+		/**
+		 * 加算
+		 */
+		struct plus
+		{
+			template <typename A, typename B>
+			inline
+			auto operator() (const A &a, const B &b) const -> decltype(a + b)
+			{
+				return a + b;
+			}
+		};
+
+		/**
+		 * 減算
+		 */
+		struct minus
+		{
+			template <typename A, typename B>
+			inline
+			auto operator() (const A &a, const B &b) const -> decltype(a - b)
+			{
+				return a - b;
+			}
+		};
+
+		/**
+		 * 演算対象の式への変換 (式はそのまま)
+		 */
+		template <typename E>
+		inline
+		const E& wrap (const node<E> &e)
+		{
+			return e.self();
+		}
+
+		/**
+		 * 演算対象の式への変換 (画像は参照に変換)
+		 */
+		template <typename Map>
+		inline
+		typename std::enable_if<!is_expression<Map>::value, terminal<typename Map::value_type>>::type
+		wrap (const Map &map)
+		{
+			return terminal<typename Map::value_type>(map);
+		}
+
+		/**
+		 * 演算対象の式の型
+		 */
+		template <typename T>
+		struct operand
+		{
+			typedef typename std::decay<decltype(wrap(std::declval<const T&>()))>::type type;
+		};
+
+		/**
+		 * 2項演算の作成
+		 */
+		template <typename F, typename L, typename R>
+		inline
+		binary<typename operand<L>::type, typename operand<R>::type, F>
+		make_binary (const L &l, const R &r)
+		{
+			return binary<typename operand<L>::type, typename operand<R>::type, F>(wrap(l), wrap(r));
+		}
+
+		/**
+		 * 演算子の戻り値の型
+		 *
+		 * 少なくとも一方が式の場合だけ定義する
+		 */
+		template <typename L, typename R, typename F,
+			bool = is_expression<L>::value || is_expression<R>::value>
+		struct binary_result
+		{
+		};
+
+		template <typename L, typename R, typename F>
+		struct binary_result<L, R, F, true>
+		{
+			typedef binary<typename operand<L>::type, typename operand<R>::type, F> type;
+		};
+
+		/**
+		 * 式の評価
+		 *
+		 * 行毎に内側のループを回すため、コンパイラがベクトル化できる
+		 *
+		 * @param e 式
+		 * @param dst 書き込み先の左上画素
+		 * @param stride 書き込み先の行ピッチ
+		 */
+		template <typename E, typename T>
+		inline
+		void evaluate (const node<E> &e, T *dst, const int stride)
+		{
+			const E &expr = e.self();
+			const int w = expr.width();
+			const int h = expr.height();
+
+			for (int y=0; y<h; ++y, dst += stride) {
+				for (int x=0; x<w; ++x) {
+					dst[x] = static_cast<T>(expr(x, y));
+				}
+			}
+		}
+
+		/**
+		 * 式の総和
+		 *
+		 * @param e 式
+		 * @return 総和
+		 */
+		template <typename E>
+		inline
+		double accumulate (const node<E> &e)
+		{
+			const E &expr = e.self();
+			const int w = expr.width();
+			const int h = expr.height();
+			double ret = 0.0;
+
+			for (int y=0; y<h; ++y) {
+				for (int x=0; x<w; ++x) {
+					ret += expr(x, y);
+				}
+			}
+
+			return ret;
+		}
+	}
+
+	/**
+	 * 式の加算
+	 *
+	 * 画像と式、式と式の組み合わせで使用する
+	 */
+	template <typename L, typename R>
+	inline
+	typename expression::binary_result<L, R, expression::plus>::type
+	operator+ (const L &l, const R &r)
+	{
+		return expression::make_binary<expression::plus>(l, r);
+	}
+
+	/**
+	 * 式の減算
+	 *
+	 * 画像と式、式と式の組み合わせで使用する
+	 */
+	template <typename L, typename R>
+	inline
+	typename expression::binary_result<L, R, expression::minus>::type
+	operator- (const L &l, const R &r)
+	{
+		return expression::make_binary<expression::minus>(l, r);
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,147 @@
+#ifndef _IMAGE_FRAME_
+#define _IMAGE_FRAME_
+
+#include <utility>
+#include <type_traits>
+
+#include "container.hpp"
+#include "cached.hpp"
+#include "integral.hpp"
+#include "padded.hpp"
+#include "interpolation.hpp"
+#include "sad.hpp"
+
+namespace Image
+{
+	/**
+	 * 探索対象のフレーム
+	 *
+	 * 画像と、探索で使用する派生データ (積分画像など) をまとめて保持する
+	 * 派生データは必要になった時点で一度だけ作成され、
+	 * フレームが次の組の元画像になっても再利用される
+	 * 派生データとの整合性を保つため、生成後に画素を書き換えてはならない
+	 */
+	template <typename T>
+	class frame : public container<T>
+	{
+	public:
+		typedef typename sad_traits<T>::type sum_type;
+
+	private:
+		cached<integral_image<sum_type>> _integral;
+		cached<Image::padded<T>> _padded;
+		cached<subpel_planes<T>> _subpel;
+		cached<frame> _downsampled;
+
+	public:
+		/**
+		 * デフォルトコンストラクタ
+		 */
+		frame ()
+			: container<T>()
+		{
+		}
+
+		/**
+		 * コンストラクタ
+		 *
+		 * @param image 画像
+		 */
+		frame (container<T> image)
+			: container<T>(std::move(image))
+		{
+		}
+
+		/**
+		 * 積分画像の取得
+		 *
+		 * @return 積分画像
+		 */
+		const integral_image<sum_type>& integral () const
+		{
+			return _integral.get([this] {
+				return integral_image<sum_type>(static_cast<const container<T>&>(*this));
+			});
+		}
+
+		/**
+		 * 拡張画像の取得
+		 *
+		 * 拡張画素数毎に一度だけ作成する
+		 *
+		 * @param margin 上下左右に拡張する画素数
+		 * @return 拡張画像
+		 */
+		const Image::padded<T>& padded (const unsigned int margin) const
+		{
+			return _padded.get(margin, [this, margin] {
+				return Image::padded<T>(static_cast<const container<T>&>(*this), margin);
+			});
+		}
+
+		/**
+		 * 小数画素位置の参照画像の取得
+		 *
+		 * 拡張画素数毎に一度だけ補間する
+		 *
+		 * @param margin 上下左右に拡張する画素数
+		 * @return 小数画素位置の参照画像
+		 */
+		const subpel_planes<T>& subpel (const unsigned int margin) const
+		{
+			return _subpel.get(margin, [this, margin] {
+				return subpel_planes<T>(static_cast<const container<T>&>(*this), margin);
+			});
+		}
+
+		/**
+		 * 縦横 1/2 に縮小したフレームの取得
+		 *
+		 * 2x2画素の平均 (四捨五入) で縮小し、一度だけ作成する
+		 * 縮小したフレームも自身の派生データを保持する
+		 *
+		 * @return 縮小したフレーム
+		 */
+		const frame& downsampled () const
+		{
+			return _downsampled.get([this] {
+				container<T> image(this->width() / 2, this->height() / 2);
+				for (int y=0; y<image.height(); ++y) {
+					for (int x=0; x<image.width(); ++x) {
+						image(x, y) = average(
+							(*this)(2*x, 2*y),   (*this)(2*x+1, 2*y),
+							(*this)(2*x, 2*y+1), (*this)(2*x+1, 2*y+1) );
+					}
+				}
+				return frame(std::move(image));
+			});
+		}
+
+		/**
+		 * 画像ピラミッドの段の取得
+		 *
+		 * @param level 段数 (0:自身, n:縦横 1/2^n)
+		 * @return 指定した段のフレーム
+		 */
+		const frame& pyramid (const unsigned int level) const
+		{
+			return (level == 0) ? *this : downsampled().pyramid(level - 1);
+		}
+
+	private:
+		/**
+		 * 4画素の平均
+		 *
+		 * 整数画素は四捨五入する
+		 */
+		static T average (const T a, const T b, const T c, const T d)
+		{
+			typedef typename sad_traits<T>::type sum_type;
+			sum_type sum = static_cast<sum_type>(a) + b + c + d;
+			return static_cast<T>(std::is_integral<T>::value ? (sum + 2) / 4 : sum / 4);
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
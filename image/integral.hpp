@@ -0,0 +1,64 @@
+#ifndef _IMAGE_INTEGRAL_
+#define _IMAGE_INTEGRAL_
+
+#include "container.hpp"
+
+namespace Image
+{
+	/**
+	 * 積分画像 (summed area table)
+	 *
+	 * 任意の矩形の画素和を4回の参照で求める
+	 * 整数型は桁あふれしても矩形の和が型に収まれば正しい値を返す
+	 */
+	template <typename V>
+	class integral_image
+	{
+	private:
+		int _margin;
+		container<V> _sum;
+
+	public:
+		typedef V value_type;
+
+		/**
+		 * コンストラクタ
+		 *
+		 * @param image 元画像
+		 * @param margin 画像外に参照できる画素数 (拡張画像用)
+		 */
+		template <typename Map>
+		explicit integral_image (const Map &image, const int margin = 0)
+			: _margin(margin),
+			  _sum(image.width()+2*margin+1, image.height()+2*margin+1)
+		{
+			for (int y=0; y<image.height()+2*margin; ++y) {
+				V row = 0;
+				for (int x=0; x<image.width()+2*margin; ++x) {
+					row += image(x-margin, y-margin);
+					_sum(x+1, y+1) = _sum(x+1, y) + row;
+				}
+			}
+		}
+
+		/**
+		 * 矩形の画素和
+		 *
+		 * @param x 矩形左上 x座標 (-margin 以上)
+		 * @param y 矩形左上 y座標 (-margin 以上)
+		 * @param w 矩形の横幅
+		 * @param h 矩形の縦幅
+		 * @return 画素和
+		 */
+		inline
+		V sum (const int x, const int y, const unsigned int w, const unsigned int h) const
+		{
+			int sx = x + _margin;
+			int sy = y + _margin;
+			return _sum(sx+w, sy+h) - _sum(sx, sy+h) - _sum(sx+w, sy) + _sum(sx, sy);
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,402 @@
+#ifndef _IMAGE_INTERPOLATION_
+#define _IMAGE_INTERPOLATION_
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include "container.hpp"
+#include "padded.hpp"
+#include "view.hpp"
+#include "sad.hpp"
+
+namespace Image
+{
+	/**
+	 * 小数画素位置の補間
+	 *
+	 * 1/4 画素毎の位相に6タップの分離型フィルタを横・縦の順に掛ける
+	 * 1/2 画素は (1, -5, 20, 20, -5, 1) / 32、1/4 画素はそれと整数画素の平均とし、
+	 * 横方向の結果は丸めずに保持して縦方向の後にまとめて丸める
+	 */
+	namespace interpolation
+	{
+		/**
+		 * 1/4 画素単位の位相の数
+		 */
+		enum : int { scale = 4 };
+
+		/**
+		 * フィルタの中心より前 (後) に参照する画素数
+		 */
+		enum : int { before = 2, after = 3 };
+
+		/**
+		 * 横方向の補間結果の型
+		 *
+		 * 8bit画素は16bitで保持する (SIMDで計算する)
+		 */
+		template <typename T>
+		struct traits
+		{
+			typedef typename std::conditional<
+				std::is_same<T, unsigned char>::value, short,
+				typename std::conditional<std::is_integral<T>::value, long, double>::type>::type type;
+		};
+
+		/**
+		 * フィルタ係数 (合計 64)
+		 *
+		 * @param phase 位相 (0 〜 3, 1/4 画素単位)
+		 * @return 画素 -2 〜 +3 の係数
+		 */
+		inline
+		const int* taps (const int phase)
+		{
+			static const int table[scale][6] = {
+				{0,   0, 64,  0,   0, 0},
+				{1,  -5, 52, 20,  -5, 1},
+				{2, -10, 40, 40, -10, 2},
+				{1,  -5, 20, 52,  -5, 1}
+			};
+			return table[phase];
+		}
+
+		/**
+		 * 縦方向の結果の丸め (整数画素)
+		 */
+		template <typename T, typename I>
+		inline
+		typename std::enable_if<std::is_integral<T>::value, T>::type
+		round (const I sum)
+		{
+			I v = (sum + 2048) >> 12;
+			v = std::min<I>(std::max<I>(v, std::numeric_limits<T>::lowest()), std::numeric_limits<T>::max());
+			return static_cast<T>(v);
+		}
+
+		/**
+		 * 縦方向の結果の丸め (浮動小数点画素)
+		 */
+		template <typename T, typename I>
+		inline
+		typename std::enable_if<!std::is_integral<T>::value, T>::type
+		round (const I sum)
+		{
+			return static_cast<T>(sum / 4096);
+		}
+
+		/**
+		 * 横方向の補間 スカラー版
+		 *
+		 * @param src 入力の左上画素 (左に2画素、右に3画素多く参照する)
+		 * @param src_stride 入力の行ピッチ
+		 * @param dst 出力の左上
+		 * @param dst_stride 出力の行ピッチ
+		 * @param width 横幅
+		 * @param height 縦幅
+		 * @param phase 位相 (1/4 画素単位)
+		 */
+		template <typename T, typename I>
+		inline
+		void horizontal_scalar (
+			const T *src, const int src_stride,
+			I *dst, const int dst_stride,
+			const int width, const int height,
+			const int phase )
+		{
+			const int *t = taps(phase);
+
+			for (int y=0; y<height; ++y, src += src_stride, dst += dst_stride) {
+				for (int x=0; x<width; ++x) {
+					I sum = 0;
+					for (int k=0; k<6; ++k) {
+						sum += static_cast<I>(t[k]) * src[x + k - before];
+					}
+					dst[x] = sum;
+				}
+			}
+		}
+
+		/**
+		 * 縦方向の補間 スカラー版
+		 *
+		 * @param src 横方向の補間結果の左上 (上に2行、下に3行多く参照する)
+		 * @param src_stride 横方向の補間結果の行ピッチ
+		 * @param dst 出力の左上画素
+		 * @param dst_stride 出力の行ピッチ
+		 * @param width 横幅
+		 * @param height 縦幅
+		 * @param phase 位相 (1/4 画素単位)
+		 */
+		template <typename I, typename T>
+		inline
+		void vertical_scalar (
+			const I *src, const int src_stride,
+			T *dst, const int dst_stride,
+			const int width, const int height,
+			const int phase )
+		{
+			const int *t = taps(phase);
+
+			for (int y=0; y<height; ++y, src += src_stride, dst += dst_stride) {
+				for (int x=0; x<width; ++x) {
+					typename std::conditional<std::is_integral<I>::value, long, double>::type sum = 0;
+					for (int k=0; k<6; ++k) {
+						sum += t[k] * src[x + (k - before) * src_stride];
+					}
+					dst[x] = round<T>(sum);
+				}
+			}
+		}
+
+#ifdef IMAGE_SAD_X86
+		/**
+		 * 横方向の補間 SSE2版 (8bit画素)
+		 *
+		 * 8画素ずつ16bitに広げて係数を掛け合わせる
+		 */
+		inline
+		void horizontal_sse2 (
+			const unsigned char *src, const int src_stride,
+			short *dst, const int dst_stride,
+			const int width, const int height,
+			const int phase )
+		{
+			const int *t = taps(phase);
+			const __m128i zero = _mm_setzero_si128();
+			__m128i c[6];
+			for (int k=0; k<6; ++k) {
+				c[k] = _mm_set1_epi16(static_cast<short>(t[k]));
+			}
+
+			const int simd_width = width & ~7;
+			for (int y=0; y<height; ++y, src += src_stride, dst += dst_stride) {
+				for (int x=0; x<simd_width; x += 8) {
+					__m128i acc = zero;
+					for (int k=0; k<6; ++k) {
+						__m128i s = _mm_unpacklo_epi8(
+							_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + x + k - before)), zero);
+						acc = _mm_add_epi16(acc, _mm_mullo_epi16(s, c[k]));
+					}
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), acc);
+				}
+			}
+
+			//残りの列はスカラー版で処理
+			if (simd_width < width) {
+				horizontal_scalar(src - height * src_stride + simd_width, src_stride,
+				                  dst - height * dst_stride + simd_width, dst_stride,
+				                  width - simd_width, height, phase);
+			}
+		}
+
+		/**
+		 * 縦方向の補間 SSE2版 (8bit画素)
+		 *
+		 * 隣接2行を交互に並べて pmaddwd で32bitに累積し、丸めて8bitに飽和させる
+		 */
+		inline
+		void vertical_sse2 (
+			const short *src, const int src_stride,
+			unsigned char *dst, const int dst_stride,
+			const int width, const int height,
+			const int phase )
+		{
+			const int *t = taps(phase);
+			__m128i c[3];
+			for (int k=0; k<3; ++k) {
+				short t0 = static_cast<short>(t[2*k]);
+				short t1 = static_cast<short>(t[2*k+1]);
+				c[k] = _mm_set_epi16(t1, t0, t1, t0, t1, t0, t1, t0);
+			}
+			const __m128i rounding = _mm_set1_epi32(2048);
+
+			const int simd_width = width & ~7;
+			for (int y=0; y<height; ++y, src += src_stride, dst += dst_stride) {
+				for (int x=0; x<simd_width; x += 8) {
+					__m128i lo = rounding;
+					__m128i hi = rounding;
+					for (int k=0; k<3; ++k) {
+						__m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+							src + x + (2*k   - before) * src_stride));
+						__m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+							src + x + (2*k+1 - before) * src_stride));
+						lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(r0, r1), c[k]));
+						hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(r0, r1), c[k]));
+					}
+					__m128i v = _mm_packs_epi32(_mm_srai_epi32(lo, 12), _mm_srai_epi32(hi, 12));
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(v, v));
+				}
+			}
+
+			//残りの列はスカラー版で処理
+			if (simd_width < width) {
+				vertical_scalar(src - height * src_stride + simd_width, src_stride,
+				                dst - height * dst_stride + simd_width, dst_stride,
+				                width - simd_width, height, phase);
+			}
+		}
+#endif
+
+		/**
+		 * 横方向の補間
+		 */
+		template <typename T, typename I>
+		inline
+		void horizontal (
+			const T *src, const int src_stride,
+			I *dst, const int dst_stride,
+			const int width, const int height,
+			const int phase )
+		{
+			horizontal_scalar(src, src_stride, dst, dst_stride, width, height, phase);
+		}
+
+		/**
+		 * 縦方向の補間
+		 */
+		template <typename I, typename T>
+		inline
+		void vertical (
+			const I *src, const int src_stride,
+			T *dst, const int dst_stride,
+			const int width, const int height,
+			const int phase )
+		{
+			vertical_scalar(src, src_stride, dst, dst_stride, width, height, phase);
+		}
+
+#ifdef IMAGE_SAD_X86
+		inline
+		void horizontal (
+			const unsigned char *src, const int src_stride,
+			short *dst, const int dst_stride,
+			const int width, const int height,
+			const int phase )
+		{
+			horizontal_sse2(src, src_stride, dst, dst_stride, width, height, phase);
+		}
+
+		inline
+		void vertical (
+			const short *src, const int src_stride,
+			unsigned char *dst, const int dst_stride,
+			const int width, const int height,
+			const int phase )
+		{
+			vertical_sse2(src, src_stride, dst, dst_stride, width, height, phase);
+		}
+#endif
+	}
+
+	/**
+	 * 小数画素位置の参照画像
+	 *
+	 * 1/4 画素単位の位相 (横4 x 縦4) 毎に補間した画像を一度だけ作成して保持する
+	 * 位相 (fx, fy) の画像の画素 (x, y) は元画像の (x + fx/4, y + fy/4) の補間値となるため、
+	 * 小数画素の動きベクトルの差分絶対値和やブロックのコピーは整数画素と同じカーネルで処理できる
+	 * 各画像は上下左右を margin 画素拡張する
+	 */
+	template <typename T>
+	class subpel_planes
+	{
+	public:
+		typedef T value_type;
+		typedef typename interpolation::traits<T>::type intermediate_type;
+
+	private:
+		int _width;
+		int _height;
+		int _margin;
+		container<T> _planes[interpolation::scale * interpolation::scale];
+
+	public:
+		/**
+		 * コンストラクタ
+		 *
+		 * @param image 元画像
+		 * @param margin 拡張する画素数
+		 */
+		template <typename Map>
+		subpel_planes (const Map &image, const unsigned int margin)
+			: _width(image.width()), _height(image.height()), _margin(margin)
+		{
+			using namespace interpolation;
+
+			const int m = margin;
+			const int w = _width  + 2*m;
+			const int h = _height + 2*m;
+
+			//フィルタが参照する範囲まで端の画素で拡張する
+			const padded<T> source(image, margin + after);
+
+			//横方向の補間結果 (縦方向のフィルタが参照する上下の行を含む)
+			container<intermediate_type> rows(w, h + before + after,
+				container<intermediate_type>::aligned_stride(w));
+
+			for (int fx=0; fx<scale; ++fx) {
+				horizontal(&source(-m, -m - before), source.stride(),
+				           &rows(0, 0), rows.stride(), w, rows.height(), fx);
+
+				for (int fy=0; fy<scale; ++fy) {
+					container<T> &plane = _planes[fy * scale + fx];
+					plane = container<T>(w, h, container<T>::aligned_stride(w));
+					vertical(&rows(0, before), rows.stride(),
+					         &plane(0, 0), plane.stride(), w, h, fy);
+				}
+			}
+		}
+
+		/**
+		 * 横幅の取得
+		 *
+		 * @return 元画像の横幅
+		 */
+		inline
+		int width () const
+		{
+			return _width;
+		}
+
+		/**
+		 * 縦幅の取得
+		 *
+		 * @return 元画像の縦幅
+		 */
+		inline
+		int height () const
+		{
+			return _height;
+		}
+
+		/**
+		 * 拡張画素数の取得
+		 *
+		 * @return 上下左右に拡張した画素数
+		 */
+		inline
+		int margin () const
+		{
+			return _margin;
+		}
+
+		/**
+		 * 位相毎の画像の取得
+		 *
+		 * 座標は元画像の左上を原点とし、拡張した範囲 (edge_margin) まで参照できる
+		 *
+		 * @param fx 横方向の位相 (0 〜 3, 1/4 画素単位)
+		 * @param fy 縦方向の位相 (0 〜 3, 1/4 画素単位)
+		 * @return 補間した画像の参照
+		 */
+		inline
+		container_view<T> plane (const int fx, const int fy) const
+		{
+			const container<T> &p = _planes[fy * interpolation::scale + fx];
+			return container_view<T>(&p(_margin, _margin), _width, _height, p.stride(), _margin);
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
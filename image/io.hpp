@@ -5,6 +5,9 @@
 #include <ostream>
 #include <fstream>
 #include <string>
+#include <type_traits>
+#include <algorithm>
+#include <cstddef>
 
 #include "container.hpp"
 
@@ -59,7 +62,7 @@ namespace Image
 
 		//読み込み
 		in.read((char*)buf, sizeof(InnerType) * width * height);
-		if (in.bad() || in.gcount() != sizeof(InnerType) * width * height) {
+		if (in.bad() || in.gcount() != static_cast<std::streamsize>(sizeof(InnerType) * width * height)) {
 			in.close();
 			throw file_read_exception("Read failed [" + filename + "]");
 		}
@@ -75,16 +78,119 @@ namespace Image
 	}
 
 	/**
-	 * ファイルの書き込み
+	 * 既存のコンテナへのファイルの読み込み
 	 *
-	 * @param filename 書き込みファイル
-	 * @param image    書き込むデータ
-	 * @return 書き込みの成功
+	 * 画素型が同じ場合は一時配列を介さずに直接読み込む
+	 * コンテナの大きさが異なる場合は作り直す
+	 *
+	 * @param filename 読み込みファイル
+	 * @param width 読み込みデータの横幅
+	 * @param height 読み込みデータの縦幅
+	 * @param image 読み込み先のコンテナ
 	 */
 	template <typename T, typename InnerType = unsigned char>
-	bool write (
+	void load (
 		const std::string &filename,
-		const container<T> &image )
+		const unsigned int width,
+		const unsigned int height,
+		container<T> &image )
+	{
+		if (!std::is_same<T, InnerType>::value) {
+			image = load<T, InnerType>(filename, width, height);
+			return;
+		}
+
+		//読み込みファイルのオープン
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (in.fail()) {
+			throw file_open_exception("Can't open " + filename);
+		}
+
+		if (image.width() != static_cast<int>(width) || image.height() != static_cast<int>(height)) {
+			image = container<T>(width, height);
+		}
+
+		//読み込み (行ピッチが横幅と異なる場合は行毎)
+		const unsigned int rows  = (image.stride() == static_cast<int>(width)) ? 1 : height;
+		const std::streamsize size = sizeof(T) * width * (height / rows);
+		for (unsigned int y=0; y<rows; ++y) {
+			in.read(reinterpret_cast<char*>(&image(0, y)), size);
+			if (in.bad() || in.gcount() != size) {
+				in.close();
+				throw file_read_exception("Read failed [" + filename + "]");
+			}
+		}
+		in.close();
+	}
+
+	/**
+	 * PGM (P5) 形式への変換
+	 *
+	 * ヘッダと画素を1つのバイト列にまとめる
+	 * 画素は行単位で変換する
+	 *
+	 * @param image 変換するデータ
+	 * @return PGM 形式のバイト列
+	 */
+	template <typename Map>
+	std::string encode_pgm (const Map &image)
+	{
+		std::string header = "P5\n"
+			+ std::to_string(image.width()) + " " + std::to_string(image.height()) + "\n"
+			+ "255\n";
+
+		std::string ret(header.size() + static_cast<std::size_t>(image.width()) * image.height(), '\0');
+		std::copy(header.begin(), header.end(), ret.begin());
+
+		char *dst = &ret[header.size()];
+		for (int y=0; y<image.height(); ++y) {
+			for (int x=0; x<image.width(); ++x) {
+				*dst++ = static_cast<char>(image(x, y));
+			}
+		}
+
+		return ret;
+	}
+
+	/**
+	 * PPM (P6) 形式への変換
+	 *
+	 * @param r 赤成分
+	 * @param g 緑成分
+	 * @param b 青成分
+	 * @return PPM 形式のバイト列
+	 */
+	template <typename Map>
+	std::string encode_ppm (const Map &r, const Map &g, const Map &b)
+	{
+		std::string header = "P6\n"
+			+ std::to_string(r.width()) + " " + std::to_string(r.height()) + "\n"
+			+ "255\n";
+
+		std::string ret(header.size() + 3 * static_cast<std::size_t>(r.width()) * r.height(), '\0');
+		std::copy(header.begin(), header.end(), ret.begin());
+
+		char *dst = &ret[header.size()];
+		for (int y=0; y<r.height(); ++y) {
+			for (int x=0; x<r.width(); ++x) {
+				*dst++ = static_cast<char>(r(x, y));
+				*dst++ = static_cast<char>(g(x, y));
+				*dst++ = static_cast<char>(b(x, y));
+			}
+		}
+
+		return ret;
+	}
+
+	/**
+	 * バイト列の書き込み
+	 *
+	 * @param filename 書き込みファイル
+	 * @param data 書き込むバイト列
+	 * @return 書き込みの成功
+	 */
+	inline
+	bool write_bytes (const std::string &filename, const std::string &data)
 	{
 		//書き込みファイルのオープン
 		std::ofstream out(filename.c_str(), std::ios::binary);
@@ -92,18 +198,45 @@ namespace Image
 			throw file_open_exception("Can't open " + filename);
 		}
 
-		//書き込み
-		out << "P5" << std::endl;
-		out << image.width() << " " << image.height() << std::endl;
-		out << "255" << std::endl;
-
-		for (auto it = image.begin(); it != image.end(); ++it) {
-			out << static_cast<char>(*it);
-		}
-		
+		//一括で書き込み
+		out.write(data.data(), data.size());
 		out.close();
 
-		return true;
+		return !out.fail();
+	}
+
+	/**
+	 * ファイルの書き込み (PGM 形式)
+	 *
+	 * @param filename 書き込みファイル
+	 * @param image    書き込むデータ
+	 * @return 書き込みの成功
+	 */
+	template <typename T, typename InnerType = unsigned char>
+	bool write (
+		const std::string &filename,
+		const container<T> &image )
+	{
+		return write_bytes(filename, encode_pgm(image));
+	}
+
+	/**
+	 * ファイルの書き込み (PPM 形式)
+	 *
+	 * @param filename 書き込みファイル
+	 * @param r 赤成分
+	 * @param g 緑成分
+	 * @param b 青成分
+	 * @return 書き込みの成功
+	 */
+	template <typename T>
+	bool write (
+		const std::string &filename,
+		const container<T> &r,
+		const container<T> &g,
+		const container<T> &b )
+	{
+		return write_bytes(filename, encode_ppm(r, g, b));
 	}
 }
 
@@ -4,20 +4,92 @@
 #include "container.hpp"
 #include <cmath>
 #include <numeric>
+#include <cassert>
+#include <type_traits>
 
 namespace std
 {
+	/**
+	 * 指数演算の関数
+	 */
+	struct _image_power
+	{
+		double b;
+
+		template <typename T>
+		inline
+		double operator() (const T c) const
+		{
+			//2乗は乗算で計算する (ベクトル化のため)
+			return (b == 2.0) ? static_cast<double>(c) * c : pow(static_cast<double>(c), b);
+		}
+	};
+
+	/**
+	 * 絶対値の関数
+	 */
+	struct _image_abs
+	{
+		template <typename T>
+		inline
+		T operator() (const T c) const
+		{
+			return (c < 0) ? -c : c;
+		}
+	};
+
 	/**
 	 * 指数演算
 	 *
 	 * @param a 適用変数
 	 * @param b 指数
-	 * @return 指数演算結果
+	 * @return 指数演算する式
+	 */
+	template <typename T>
+	Image::expression::unary<Image::expression::terminal<T>, _image_power>
+	pow (const Image::container<T>& a, double b)
+	{
+		return a.apply(_image_power{b});
+	}
+
+	/**
+	 * 指数演算
+	 *
+	 * @param a 適用する式
+	 * @param b 指数
+	 * @return 指数演算する式
+	 */
+	template <typename E>
+	Image::expression::unary<E, _image_power>
+	pow (const Image::expression::node<E>& a, double b)
+	{
+		return a.apply(_image_power{b});
+	}
+
+	/**
+	 * 絶対値
+	 *
+	 * @param a 対象コンテナ
+	 * @return 絶対値の式
 	 */
 	template <typename T>
-	Image::container<T> pow (const Image::container<T>& a, double b)
+	Image::expression::unary<Image::expression::terminal<T>, _image_abs>
+	abs (const Image::container<T>& a)
+	{
+		return a.apply(_image_abs());
+	}
+
+	/**
+	 * 絶対値
+	 *
+	 * @param a 対象の式
+	 * @return 絶対値の式
+	 */
+	template <typename E>
+	Image::expression::unary<E, _image_abs>
+	abs (const Image::expression::node<E>& a)
 	{
-		return a.apply([b](T c) { return pow(c, b); });
+		return a.apply(_image_abs());
 	}
 
 	/**
@@ -29,7 +101,21 @@ namespace std
 	template <typename T>
 	double sum (const Image::container<T>& a)
 	{
-		return std::accumulate(a.begin(), a.end(), 0.0);
+		return Image::expression::accumulate(Image::expression::terminal<T>(a));
+	}
+
+	/**
+	 * 総和演算
+	 *
+	 * 式は途中の画像を作らずに1回のループで評価する
+	 *
+	 * @param a 対象の式
+	 * @return 総和結果
+	 */
+	template <typename E>
+	double sum (const Image::expression::node<E>& a)
+	{
+		return Image::expression::accumulate(a);
 	}
 }
 
@@ -0,0 +1,399 @@
+#ifndef _IMAGE_METRIC_
+#define _IMAGE_METRIC_
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <cassert>
+
+#include "container.hpp"
+#include "sad.hpp"
+
+namespace Image
+{
+	/**
+	 * 2枚の画像の誤差
+	 *
+	 * 差分二乗和 (SSE) と差分絶対値和 (SAD) を画素数と共に保持し、
+	 * MSE と PSNR を求める
+	 */
+	struct distortion
+	{
+		double sse;
+		double sad;
+		double count;
+
+		distortion ()
+			: sse(0), sad(0), count(0)
+		{
+		}
+
+		/**
+		 * 加算
+		 *
+		 * @param obj 誤差
+		 * @return 加算結果
+		 */
+		distortion& operator+= (const distortion &obj)
+		{
+			sse   += obj.sse;
+			sad   += obj.sad;
+			count += obj.count;
+			return *this;
+		}
+
+		/**
+		 * 平均二乗誤差
+		 *
+		 * @return MSE
+		 */
+		double mse () const
+		{
+			return (count > 0) ? sse / count : 0;
+		}
+
+		/**
+		 * ピーク信号対雑音比
+		 *
+		 * @param peak 画素の最大値
+		 * @return PSNR [dB] (誤差が無い場合は無限大)
+		 */
+		double psnr (const double peak = 255.0) const
+		{
+			return 20.0 * std::log10(peak / std::sqrt(mse()));
+		}
+	};
+
+	/**
+	 * 8bit画素の誤差カーネル
+	 *
+	 * 1回の走査で差分二乗和と差分絶対値和を同時に求める
+	 */
+	namespace metric
+	{
+		/**
+		 * 誤差カーネルの関数型
+		 *
+		 * @param p1 ブロック1の左上画素
+		 * @param stride1 ブロック1の行ピッチ
+		 * @param p2 ブロック2の左上画素
+		 * @param stride2 ブロック2の行ピッチ
+		 * @param width ブロックの横幅
+		 * @param height ブロックの縦幅
+		 * @param sse 差分二乗和の保存先
+		 * @param sad 差分絶対値和の保存先
+		 */
+		typedef void (*kernel_type) (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height,
+			unsigned long long *sse, unsigned long long *sad );
+
+		/**
+		 * 誤差カーネル スカラー版
+		 */
+		inline
+		void scalar (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height,
+			unsigned long long *sse, unsigned long long *sad )
+		{
+			unsigned long long s = 0, a = 0;
+
+			for (unsigned int iy=0; iy<height; ++iy, p1 += stride1, p2 += stride2) {
+				for (unsigned int ix=0; ix<width; ++ix) {
+					int d = static_cast<int>(p1[ix]) - static_cast<int>(p2[ix]);
+					s += d * d;
+					a += std::abs(d);
+				}
+			}
+
+			*sse = s;
+			*sad = a;
+		}
+
+#ifdef IMAGE_SAD_X86
+		/**
+		 * 32bit符号なし整数4個の合計
+		 */
+		inline
+		unsigned long long _hsum_epu32 (const __m128i v)
+		{
+			return static_cast<unsigned long long>(static_cast<unsigned int>(_mm_cvtsi128_si32(v)))
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(v, 4)))
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(v, 8)))
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(v, 12)));
+		}
+
+		/**
+		 * 64bit符号なし整数2個の合計
+		 *
+		 * 32bit x86 でも使えるよう、32bit 単位で取り出す
+		 */
+		inline
+		unsigned long long _hsum_epu64 (const __m128i v)
+		{
+			unsigned long long lo = static_cast<unsigned int>(_mm_cvtsi128_si32(v))
+				| static_cast<unsigned long long>(static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(v, 4)))) << 32;
+			unsigned long long hi = static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(v, 8)))
+				| static_cast<unsigned long long>(static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(v, 12)))) << 32;
+			return lo + hi;
+		}
+
+		/**
+		 * 誤差カーネル SSE2版
+		 *
+		 * 差分を16bitに広げて pmaddwd で二乗和を、psadbw で絶対値和を求める
+		 * 32bitの累積は行毎に64bitへ移す
+		 */
+		inline
+		void sse2 (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height,
+			unsigned long long *sse, unsigned long long *sad )
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i acc_sad = _mm_setzero_si128();
+			unsigned long long s = 0, tail_sad = 0;
+
+			for (unsigned int iy=0; iy<height; ++iy, p1 += stride1, p2 += stride2) {
+				__m128i acc_sse = _mm_setzero_si128();
+				unsigned int ix = 0;
+
+				for ( ; ix+16 <= width; ix += 16) {
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1+ix));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p2+ix));
+					acc_sad = _mm_add_epi64(acc_sad, _mm_sad_epu8(a, b));
+
+					__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+					__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+					acc_sse = _mm_add_epi32(acc_sse, _mm_madd_epi16(lo, lo));
+					acc_sse = _mm_add_epi32(acc_sse, _mm_madd_epi16(hi, hi));
+
+					//32bitの累積が溢れる前に64bitへ移す
+					if ((ix & 0x3ff) == 0x3f0) {
+						s += _hsum_epu32(acc_sse);
+						acc_sse = _mm_setzero_si128();
+					}
+				}
+
+				s += _hsum_epu32(acc_sse);
+
+				//残り
+				for ( ; ix < width; ++ix) {
+					int d = static_cast<int>(p1[ix]) - static_cast<int>(p2[ix]);
+					s += d * d;
+					tail_sad += std::abs(d);
+				}
+			}
+
+			*sse = s;
+			*sad = tail_sad + _hsum_epu64(acc_sad);
+		}
+
+		/**
+		 * 誤差カーネル AVX2版
+		 */
+		__attribute__((target("avx2")))
+		inline
+		void avx2 (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height,
+			unsigned long long *sse, unsigned long long *sad )
+		{
+			const __m256i zero = _mm256_setzero_si256();
+			__m256i acc_sad = _mm256_setzero_si256();
+			unsigned long long s = 0, tail_sse = 0, tail_sad = 0;
+
+			for (unsigned int iy=0; iy<height; ++iy, p1 += stride1, p2 += stride2) {
+				__m256i acc_sse = _mm256_setzero_si256();
+				unsigned int ix = 0;
+
+				for ( ; ix+32 <= width; ix += 32) {
+					__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p1+ix));
+					__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p2+ix));
+					acc_sad = _mm256_add_epi64(acc_sad, _mm256_sad_epu8(a, b));
+
+					__m256i lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+					__m256i hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+					acc_sse = _mm256_add_epi32(acc_sse, _mm256_madd_epi16(lo, lo));
+					acc_sse = _mm256_add_epi32(acc_sse, _mm256_madd_epi16(hi, hi));
+
+					//32bitの累積が溢れる前に64bitへ移す
+					if ((ix & 0x7ff) == 0x7e0) {
+						__m128i r = _mm_add_epi32(_mm256_castsi256_si128(acc_sse), _mm256_extracti128_si256(acc_sse, 1));
+						s += _hsum_epu32(r);
+						acc_sse = _mm256_setzero_si256();
+					}
+				}
+
+				__m128i r = _mm_add_epi32(_mm256_castsi256_si128(acc_sse), _mm256_extracti128_si256(acc_sse, 1));
+				s += _hsum_epu32(r);
+
+				//残りはSSE2版で処理
+				if (ix < width) {
+					unsigned long long ts, ta;
+					sse2(p1+ix, stride1, p2+ix, stride2, width-ix, 1, &ts, &ta);
+					tail_sse += ts;
+					tail_sad += ta;
+				}
+			}
+
+			__m128i a = _mm_add_epi64(_mm256_castsi256_si128(acc_sad), _mm256_extracti128_si256(acc_sad, 1));
+			*sse = s + tail_sse;
+			*sad = tail_sad + _hsum_epu64(a);
+		}
+#endif
+
+		/**
+		 * CPUに合わせたカーネルの選択
+		 *
+		 * @param name カーネル名の保存先
+		 * @return 誤差カーネル
+		 */
+		inline
+		kernel_type select (std::string *name = nullptr)
+		{
+#ifdef IMAGE_SAD_X86
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")) {
+				if (name != nullptr) *name = "avx2";
+				return avx2;
+			}
+			if (__builtin_cpu_supports("sse2")) {
+				if (name != nullptr) *name = "sse2";
+				return sse2;
+			}
+#endif
+			if (name != nullptr) *name = "scalar";
+			return scalar;
+		}
+
+		/**
+		 * 誤差の計算
+		 *
+		 * 初回呼び出し時に選択したカーネルを使用する
+		 */
+		inline
+		void compute (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height,
+			unsigned long long *sse, unsigned long long *sad )
+		{
+			static const kernel_type k = select();
+			k(p1, stride1, p2, stride2, width, height, sse, sad);
+		}
+
+		/**
+		 * 矩形の誤差 (8bit画素)
+		 */
+		template <typename Map1, typename Map2>
+		inline
+		distortion _block (
+			const Map1 &a, const Map2 &b,
+			const int x, const int y, const unsigned int w, const unsigned int h,
+			std::true_type )
+		{
+			unsigned long long sse, sad;
+			compute(&a(x, y), a.stride(), &b(x, y), b.stride(), w, h, &sse, &sad);
+
+			distortion ret;
+			ret.sse   = static_cast<double>(sse);
+			ret.sad   = static_cast<double>(sad);
+			ret.count = static_cast<double>(w) * h;
+			return ret;
+		}
+
+		/**
+		 * 矩形の誤差 (汎用)
+		 */
+		template <typename Map1, typename Map2>
+		inline
+		distortion _block (
+			const Map1 &a, const Map2 &b,
+			const int x, const int y, const unsigned int w, const unsigned int h,
+			std::false_type )
+		{
+			distortion ret;
+			for (int iy = y; iy < y + static_cast<int>(h); ++iy) {
+				for (int ix = x; ix < x + static_cast<int>(w); ++ix) {
+					double d = static_cast<double>(a(ix, iy)) - static_cast<double>(b(ix, iy));
+					ret.sse += d * d;
+					ret.sad += std::abs(d);
+				}
+			}
+			ret.count = static_cast<double>(w) * h;
+			return ret;
+		}
+
+		/**
+		 * 矩形の誤差
+		 */
+		template <typename Map1, typename Map2>
+		inline
+		distortion block (
+			const Map1 &a, const Map2 &b,
+			const int x, const int y, const unsigned int w, const unsigned int h )
+		{
+			typedef std::integral_constant<bool,
+				std::is_same<typename Map1::value_type, unsigned char>::value &&
+				std::is_same<typename Map2::value_type, unsigned char>::value> is_byte;
+			return _block(a, b, x, y, w, h, is_byte());
+		}
+	}
+
+	/**
+	 * 2枚の画像の誤差
+	 *
+	 * 一時画像を作らずに1回の走査で SSE と SAD を求める
+	 * block_size を指定するとブロック毎の誤差も求める
+	 * 端の半端なブロックも1ブロックとして扱う
+	 *
+	 * @param a 画像1
+	 * @param b 画像2
+	 * @param block_size ブロックのサイズ (0:ブロック毎の誤差を求めない)
+	 * @param blocks ブロック毎の誤差の保存先
+	 * @return 画像全体の誤差
+	 */
+	template <typename Map1, typename Map2>
+	distortion measure (
+		const Map1 &a,
+		const Map2 &b,
+		const unsigned int block_size = 0,
+		container<distortion> *blocks = nullptr )
+	{
+		assert(a.width() == b.width() && a.height() == b.height());
+
+		if (block_size == 0 || blocks == nullptr) {
+			return metric::block(a, b, 0, 0, a.width(), a.height());
+		}
+
+		int bw = (a.width()  + block_size - 1) / block_size;
+		int bh = (a.height() + block_size - 1) / block_size;
+		*blocks = container<distortion>(bw, bh);
+
+		distortion ret;
+		for (int by=0; by<bh; ++by) {
+			for (int bx=0; bx<bw; ++bx) {
+				int x = bx * block_size;
+				int y = by * block_size;
+				unsigned int w = std::min<int>(block_size, a.width()  - x);
+				unsigned int h = std::min<int>(block_size, a.height() - y);
+
+				(*blocks)(bx, by) = metric::block(a, b, x, y, w, h);
+				ret += (*blocks)(bx, by);
+			}
+		}
+
+		return ret;
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,431 @@
+#ifndef _IMAGE_MVCACHE_
+#define _IMAGE_MVCACHE_
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
+#include <unistd.h>
+
+#include "algorithm.hpp"
+#include "mvfield.hpp"
+#include "io.hpp"
+
+namespace Image
+{
+	/**
+	 * 128bit ハッシュ
+	 *
+	 * キャッシュのキーに使用する (暗号学的な強度は持たない)
+	 */
+	class hash128
+	{
+	private:
+		std::uint64_t _a;
+		std::uint64_t _b;
+
+		static std::uint64_t rotl (const std::uint64_t x, const int r)
+		{
+			return (x << r) | (x >> (64 - r));
+		}
+
+		static std::uint64_t fmix (std::uint64_t k)
+		{
+			k ^= k >> 33;
+			k *= 0xff51afd7ed558ccdULL;
+			k ^= k >> 33;
+			k *= 0xc4ceb9fe1a85ec53ULL;
+			k ^= k >> 33;
+			return k;
+		}
+
+		void word (const std::uint64_t w)
+		{
+			_a = (_a ^ w) * 0x100000001b3ULL;
+			_b = rotl(_b ^ (w * 0x9e3779b97f4a7c15ULL), 31) * 0xc2b2ae3d27d4eb4fULL;
+		}
+
+	public:
+		hash128 ()
+			: _a(0xcbf29ce484222325ULL), _b(0x84222325cbf29ce4ULL)
+		{
+		}
+
+		/**
+		 * バイト列の追加
+		 *
+		 * @param data 先頭
+		 * @param size バイト数
+		 */
+		void update (const void *data, const std::size_t size)
+		{
+			const unsigned char *p = static_cast<const unsigned char*>(data);
+			std::size_t i = 0;
+
+			for ( ; i+8 <= size; i += 8) {
+				std::uint64_t w;
+				std::memcpy(&w, p+i, 8);
+				word(w);
+			}
+
+			std::uint64_t tail = 0;
+			for (std::size_t k=0; i+k < size; ++k) {
+				tail |= static_cast<std::uint64_t>(p[i+k]) << (8*k);
+			}
+			word(tail ^ (static_cast<std::uint64_t>(size) << 56));
+		}
+
+		/**
+		 * 文字列の追加
+		 */
+		void update (const std::string &s)
+		{
+			update(s.data(), s.size());
+		}
+
+		/**
+		 * 画像の追加
+		 *
+		 * 画素値と大きさを行単位で追加する
+		 */
+		template <typename Map>
+		void update_map (const Map &map)
+		{
+			std::int32_t size[2] = { map.width(), map.height() };
+			update(size, sizeof(size));
+			for (int y=0; y<map.height(); ++y) {
+				update(&map(0, y), sizeof(typename Map::value_type) * map.width());
+			}
+		}
+
+		/**
+		 * 16進数の文字列
+		 *
+		 * @return 32文字の16進数
+		 */
+		std::string hex () const
+		{
+			std::ostringstream out;
+			out << std::hex << std::setfill('0')
+			    << std::setw(16) << fmix(_a ^ rotl(_b, 17))
+			    << std::setw(16) << fmix(_b + _a);
+			return out.str();
+		}
+	};
+
+	/**
+	 * 動きベクトル場のディスクキャッシュ
+	 *
+	 * 2枚の画像の内容と探索の設定から求めたハッシュをキーとして、
+	 * 動きベクトルと統計情報をディレクトリ内の1ファイルに保存する
+	 * 合計サイズが上限を超えると、最後に参照した時刻が最も古いものから削除する
+	 * 複数スレッドから同時に使用してもよい
+	 */
+	class mv_cache
+	{
+	private:
+		/**
+		 * キャッシュファイルの情報
+		 */
+		struct entry
+		{
+			std::size_t size;
+			double access;
+		};
+
+		std::string _dir;
+		std::size_t _capacity;
+		std::size_t _total;
+		std::map<std::string, entry> _entries;
+		std::mutex _mutex;
+		std::atomic<unsigned int> _hits;
+		std::atomic<unsigned int> _misses;
+
+		static const char* suffix ()
+		{
+			return ".mvc";
+		}
+
+	public:
+		/**
+		 * コンストラクタ
+		 *
+		 * ディレクトリ内の既存のキャッシュファイルを読み込む
+		 *
+		 * @param dir キャッシュディレクトリ (存在しなければ作成する)
+		 * @param capacity 合計サイズの上限 [byte]
+		 */
+		mv_cache (const std::string &dir, const std::size_t capacity)
+			: _dir(dir), _capacity(capacity), _total(0), _hits(0), _misses(0)
+		{
+			::mkdir(_dir.c_str(), 0755);
+
+			DIR *d = ::opendir(_dir.c_str());
+			if (d == nullptr) {
+				throw file_open_exception("Can't open " + _dir);
+			}
+
+			const std::string ext = suffix();
+			while (struct dirent *e = ::readdir(d)) {
+				std::string name = e->d_name;
+				if (name.size() <= ext.size() || name[0] == '.'
+					|| name.compare(name.size() - ext.size(), ext.size(), ext) != 0)
+				{
+					continue;
+				}
+
+				struct stat st;
+				if (::stat((_dir + "/" + name).c_str(), &st) != 0) {
+					continue;
+				}
+				std::string key = name.substr(0, name.size() - ext.size());
+				_entries[key] = { static_cast<std::size_t>(st.st_size),
+				                  st.st_mtim.tv_sec + st.st_mtim.tv_nsec * 1e-9 };
+				_total += st.st_size;
+			}
+			::closedir(d);
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			evict();
+		}
+
+		mv_cache (const mv_cache&) = delete;
+		mv_cache& operator= (const mv_cache&) = delete;
+
+		/**
+		 * キーの作成
+		 *
+		 * @param premap 原画像
+		 * @param crtmap 次画像
+		 * @param macro_block_size ブロックのサイズ
+		 * @param search_size ブロックの探索範囲
+		 * @param identity 検出アルゴリズムとその設定を表す文字列
+		 * @param previous 検出アルゴリズムが参照する前の組の動きベクトル (nullptr:無し)
+		 * @return キー
+		 */
+		template <typename Map>
+		static std::string key (
+			const Map &premap,
+			const Map &crtmap,
+			const unsigned int macro_block_size,
+			const unsigned int search_size,
+			const std::string &identity,
+			const ve_container *previous = nullptr )
+		{
+			hash128 h;
+			h.update("mvc1");
+			h.update(identity);
+
+			std::uint32_t params[2] = { macro_block_size, search_size };
+			h.update(params, sizeof(params));
+
+			h.update_map(premap);
+			h.update_map(crtmap);
+
+			if (previous != nullptr) {
+				h.update(encode_mv_field(mv_field{0, 0, "", *previous, container<unsigned char>()}));
+			}
+
+			return h.hex();
+		}
+
+		/**
+		 * キャッシュの検索
+		 *
+		 * 見つかった場合は参照時刻を更新する
+		 *
+		 * @param key キー
+		 * @param vectors 動きベクトルの保存先
+		 * @param info 統計情報の保存先 (nullptr:保存しない)
+		 * @return true:見つかった
+		 */
+		bool find (const std::string &key, ve_container *vectors, search_info *info)
+		{
+			std::string filename = path(key);
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto it = _entries.find(key);
+				if (it == _entries.end()) {
+					++_misses;
+					return false;
+				}
+				it->second.access = now();
+			}
+
+			//他の処理が削除した場合や壊れている場合は未登録として扱い、登録を取り消す
+			try {
+				std::ifstream in(filename.c_str(), std::ios::binary);
+				std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+				search_info stored;
+				if (in.fail() && !in.eof()) {
+					throw file_read_exception("Read failed [" + filename + "]");
+				}
+				*vectors = decode(data, &stored);
+				if (info != nullptr) {
+					*info = stored;
+				}
+			}
+			catch (const std::exception &) {
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto it = _entries.find(key);
+				if (it != _entries.end()) {
+					_total -= it->second.size;
+					_entries.erase(it);
+				}
+				std::remove(filename.c_str());
+				++_misses;
+				return false;
+			}
+
+			::utime(filename.c_str(), nullptr);
+			++_hits;
+			return true;
+		}
+
+		/**
+		 * キャッシュへの保存
+		 *
+		 * 一時ファイルに書き込んでから置き換えるため、読み込み中のファイルは壊れない
+		 * 一時ファイル名はプロセスとスレッド毎に異なるため、ディレクトリを複数のプロセスで共有してもよい
+		 * 書き込みに失敗した場合は保存しない
+		 *
+		 * @param key キー
+		 * @param vectors 動きベクトル
+		 * @param info 統計情報
+		 */
+		void store (const std::string &key, const ve_container &vectors, const search_info &info)
+		{
+			std::string data = encode(vectors, info);
+			std::ostringstream tmp;
+			tmp << _dir << "/." << key << "." << ::getpid() << "." << std::this_thread::get_id() << ".tmp";
+
+			if (!write_bytes(tmp.str(), data)) {
+				std::remove(tmp.str().c_str());
+				return;
+			}
+			if (std::rename(tmp.str().c_str(), path(key).c_str()) != 0) {
+				std::remove(tmp.str().c_str());
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto it = _entries.find(key);
+			if (it != _entries.end()) {
+				_total -= it->second.size;
+			}
+			_entries[key] = { data.size(), now() };
+			_total += data.size();
+			evict();
+		}
+
+		/**
+		 * 見つかった回数の取得
+		 */
+		unsigned int hits () const
+		{
+			return _hits;
+		}
+
+		/**
+		 * 見つからなかった回数の取得
+		 */
+		unsigned int misses () const
+		{
+			return _misses;
+		}
+
+		/**
+		 * 合計サイズの取得
+		 *
+		 * @return キャッシュファイルの合計サイズ [byte]
+		 */
+		std::size_t size ()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _total;
+		}
+
+	private:
+		/**
+		 * キャッシュファイル名
+		 */
+		std::string path (const std::string &key) const
+		{
+			return _dir + "/" + key + suffix();
+		}
+
+		/**
+		 * 現在時刻
+		 */
+		static double now ()
+		{
+			struct timespec ts;
+			::clock_gettime(CLOCK_REALTIME, &ts);
+			return ts.tv_sec + ts.tv_nsec * 1e-9;
+		}
+
+		/**
+		 * 上限を超えた分の削除 (ロック中に呼び出す)
+		 */
+		void evict ()
+		{
+			while (_total > _capacity && !_entries.empty()) {
+				auto oldest = _entries.begin();
+				for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+					if (it->second.access < oldest->second.access) {
+						oldest = it;
+					}
+				}
+				std::remove(path(oldest->first).c_str());
+				_total -= oldest->second.size;
+				_entries.erase(oldest);
+			}
+		}
+
+		/**
+		 * キャッシュファイルの内容
+		 *
+		 * "MVC1", 統計情報 (double x4), 動きベクトル場 (mv_field の形式)
+		 */
+		static std::string encode (const ve_container &vectors, const search_info &info)
+		{
+			double values[4] = { info.match, info.pruned, info.rows, info.cost };
+			std::string out = "MVC1";
+			out.append(reinterpret_cast<const char*>(values), sizeof(values));
+			out += encode_mv_field(mv_field{0, 0, "", vectors, container<unsigned char>()});
+			return out;
+		}
+
+		static ve_container decode (const std::string &data, search_info *info)
+		{
+			double values[4];
+			if (data.size() < 4 + sizeof(values) || data.compare(0, 4, "MVC1") != 0) {
+				throw file_read_exception("Read failed [not a motion vector cache]");
+			}
+			std::memcpy(values, data.data() + 4, sizeof(values));
+			info->match  = values[0];
+			info->pruned = values[1];
+			info->rows   = values[2];
+			info->cost   = values[3];
+			return decode_mv_field(data.substr(4 + sizeof(values))).vectors;
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
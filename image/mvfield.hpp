@@ -0,0 +1,379 @@
+#ifndef _IMAGE_MVFIELD_
+#define _IMAGE_MVFIELD_
+
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cassert>
+
+#include "container.hpp"
+#include "algorithm.hpp"
+#include "io.hpp"
+
+namespace Image
+{
+	/**
+	 * 動きベクトル場
+	 *
+	 * 1組の画像の探索結果と、探索時の設定をまとめる
+	 */
+	struct mv_field
+	{
+		unsigned int block_size;
+		unsigned int search_size;
+		std::string algorithm;
+		ve_container vectors;
+
+		//ブロック毎の参照フレームの番号 (0:直前のフレーム, 空:直前のフレームのみ)
+		container<unsigned char> references;
+	};
+
+	/**
+	 * 動きベクトル場の符号化方式
+	 */
+	enum class mv_coding
+	{
+		//固定長 (全ての差分が収まる int8 / int16)
+		fixed,
+		//可変長 (zigzag + varint)
+		varint
+	};
+
+	/**
+	 * 動きベクトル場のバイナリ形式
+	 *
+	 * "MVF1", 横ブロック数, 縦ブロック数, ブロックのサイズ, 探索範囲 (各 uint16),
+	 * 符号化方式 (uint8 0:int8, 1:int16, 2:varint), アルゴリズム名 (uint8 長さ + 文字列) の後に、
+	 * ラスタ順に各ブロックの x, y 成分を左のブロックとの差分で格納する
+	 * 符号化方式に references (0x80) を加えた場合は、続けてラスタ順に各ブロックの
+	 * 参照フレームの番号 (uint8) を格納する
+	 * 多バイトの値はリトルエンディアンとする
+	 */
+	namespace mvf
+	{
+		static const char magic[4] = {'M', 'V', 'F', '1'};
+
+		enum : unsigned char { int8 = 0, int16 = 1, varint = 2 };
+
+		//参照フレームの番号を格納する
+		enum : unsigned char { references = 0x80 };
+
+		/**
+		 * uint16 の書き込み
+		 */
+		inline
+		void put_u16 (std::string &out, const unsigned int value)
+		{
+			out.push_back(static_cast<char>(value & 0xff));
+			out.push_back(static_cast<char>((value >> 8) & 0xff));
+		}
+
+		/**
+		 * 符号付き整数の可変長での書き込み
+		 */
+		inline
+		void put_varint (std::string &out, const int value)
+		{
+			std::uint32_t v = (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+			while (v >= 0x80) {
+				out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+				v >>= 7;
+			}
+			out.push_back(static_cast<char>(v));
+		}
+
+		/**
+		 * バイト列の読み込み位置
+		 */
+		class reader
+		{
+		private:
+			const std::string &_data;
+			std::size_t _pos;
+
+		public:
+			explicit reader (const std::string &data)
+				: _data(data), _pos(0)
+			{
+			}
+
+			unsigned int u8 ()
+			{
+				if (_pos >= _data.size()) {
+					throw file_read_exception("Read failed [truncated motion vector field]");
+				}
+				return static_cast<unsigned char>(_data[_pos++]);
+			}
+
+			unsigned int u16 ()
+			{
+				unsigned int lo = u8();
+				return lo | (u8() << 8);
+			}
+
+			int s8 ()
+			{
+				return static_cast<signed char>(u8());
+			}
+
+			int s16 ()
+			{
+				return static_cast<std::int16_t>(u16());
+			}
+
+			int varint ()
+			{
+				std::uint32_t v = 0;
+				for (unsigned int shift = 0; ; shift += 7) {
+					if (shift > 28) {
+						throw file_read_exception("Read failed [malformed motion vector field]");
+					}
+					unsigned int b = u8();
+					v |= static_cast<std::uint32_t>(b & 0x7f) << shift;
+					if ((b & 0x80) == 0) {
+						break;
+					}
+				}
+				return static_cast<int>(v >> 1) ^ -static_cast<int>(v & 1);
+			}
+
+			std::string bytes (const std::size_t n)
+			{
+				if (_data.size() - _pos < n) {
+					throw file_read_exception("Read failed [truncated motion vector field]");
+				}
+				_pos += n;
+				return _data.substr(_pos - n, n);
+			}
+		};
+	}
+
+	/**
+	 * 動きベクトル場の符号化
+	 *
+	 * @param field 動きベクトル場
+	 * @param coding 符号化方式
+	 * @return バイナリ形式のバイト列
+	 */
+	inline
+	std::string encode_mv_field (const mv_field &field, const mv_coding coding = mv_coding::fixed)
+	{
+		const ve_container &ve = field.vectors;
+
+		//左のブロックとの差分の範囲から固定長の幅を決める
+		int lower = 0, upper = 0;
+		for (int y=0; y<ve.height(); ++y) {
+			ve_pair left(0, 0);
+			for (int x=0; x<ve.width(); ++x) {
+				lower = std::min({lower, ve(x, y).first - left.first, ve(x, y).second - left.second});
+				upper = std::max({upper, ve(x, y).first - left.first, ve(x, y).second - left.second});
+				left = ve(x, y);
+			}
+		}
+
+		unsigned char type = mvf::varint;
+		if (coding == mv_coding::fixed) {
+			if (lower >= -128 && upper <= 127) {
+				type = mvf::int8;
+			}
+			else if (lower >= -32768 && upper <= 32767) {
+				type = mvf::int16;
+			}
+		}
+
+		//ヘッダ
+		std::string out(mvf::magic, mvf::magic + 4);
+		mvf::put_u16(out, ve.width());
+		mvf::put_u16(out, ve.height());
+		mvf::put_u16(out, field.block_size);
+		mvf::put_u16(out, field.search_size);
+		out.push_back(static_cast<char>(field.references.width() == 0 ? type : (type | mvf::references)));
+		std::string name = field.algorithm.substr(0, 255);
+		out.push_back(static_cast<char>(name.size()));
+		out += name;
+
+		//動きベクトル
+		for (int y=0; y<ve.height(); ++y) {
+			ve_pair left(0, 0);
+			for (int x=0; x<ve.width(); ++x) {
+				int d[2] = { ve(x, y).first - left.first, ve(x, y).second - left.second };
+				for (int i=0; i<2; ++i) {
+					switch (type) {
+					case mvf::int8:
+						out.push_back(static_cast<char>(d[i]));
+						break;
+					case mvf::int16:
+						mvf::put_u16(out, static_cast<std::uint16_t>(d[i]));
+						break;
+					default:
+						mvf::put_varint(out, d[i]);
+						break;
+					}
+				}
+				left = ve(x, y);
+			}
+		}
+
+		//参照フレームの番号
+		if (field.references.width() > 0) {
+			assert(field.references.width() == ve.width() && field.references.height() == ve.height());
+			for (int y=0; y<ve.height(); ++y) {
+				for (int x=0; x<ve.width(); ++x) {
+					out.push_back(static_cast<char>(field.references(x, y)));
+				}
+			}
+		}
+
+		return out;
+	}
+
+	/**
+	 * 動きベクトル場の復号
+	 *
+	 * @param data バイナリ形式のバイト列
+	 * @return 動きベクトル場
+	 */
+	inline
+	mv_field decode_mv_field (const std::string &data)
+	{
+		mvf::reader in(data);
+
+		if (in.bytes(4) != std::string(mvf::magic, mvf::magic + 4)) {
+			throw file_read_exception("Read failed [not a motion vector field]");
+		}
+
+		mv_field field;
+		unsigned int width  = in.u16();
+		unsigned int height = in.u16();
+		field.block_size  = in.u16();
+		field.search_size = in.u16();
+		unsigned int type = in.u8();
+		bool references = (type & mvf::references) != 0;
+		type &= ~static_cast<unsigned int>(mvf::references);
+		field.algorithm = in.bytes(in.u8());
+
+		if (type > mvf::varint) {
+			throw file_read_exception("Read failed [unknown motion vector coding]");
+		}
+
+		field.vectors = ve_container(width, height);
+		for (unsigned int y=0; y<height; ++y) {
+			ve_pair left(0, 0);
+			for (unsigned int x=0; x<width; ++x) {
+				int d[2];
+				for (int i=0; i<2; ++i) {
+					d[i] = (type == mvf::int8)  ? in.s8()
+					     : (type == mvf::int16) ? in.s16()
+					     :                        in.varint();
+				}
+				left = ve_pair(left.first + d[0], left.second + d[1]);
+				field.vectors(x, y) = left;
+			}
+		}
+
+		if (references) {
+			field.references = container<unsigned char>(width, height);
+			for (unsigned int y=0; y<height; ++y) {
+				for (unsigned int x=0; x<width; ++x) {
+					field.references(x, y) = in.u8();
+				}
+			}
+		}
+
+		return field;
+	}
+
+	/**
+	 * 動きベクトル場の検査
+	 *
+	 * 読み込んだ動きベクトル場が対象画像に収まり、全ての動きベクトルが
+	 * 画像外の参照できる範囲 (margin) 内を指すか検査する
+	 * 参照フレームの番号を持つ場合は、全ての番号が保持している参照フレームを指すか検査する
+	 *
+	 * @param field 動きベクトル場
+	 * @param width 対象画像の幅
+	 * @param height 対象画像の高さ
+	 * @param margin 画像外を参照できる幅
+	 * @param reference_count 保持している参照フレームの数
+	 */
+	inline
+	void check_mv_field (
+		const mv_field &field,
+		const int width, const int height,
+		const unsigned int margin,
+		const unsigned int reference_count = 1 )
+	{
+		if (field.block_size == 0) {
+			throw file_read_exception("Read failed [invalid block size in motion vector field]");
+		}
+
+		int bs = field.block_size;
+		int m  = margin;
+		if (field.vectors.width() * bs > width || field.vectors.height() * bs > height) {
+			throw file_read_exception("Read failed [motion vector field does not match the frame size]");
+		}
+
+		for (int cy=0; cy<field.vectors.height(); ++cy) {
+			for (int cx=0; cx<field.vectors.width(); ++cx) {
+				int x = cx * bs + field.vectors(cx, cy).first;
+				int y = cy * bs + field.vectors(cx, cy).second;
+				if (x < -m || y < -m || x+bs > width+m || y+bs > height+m) {
+					throw file_read_exception("Read failed [motion vector out of range]");
+				}
+			}
+		}
+
+		for (auto it = field.references.begin(); it != field.references.end(); ++it) {
+			if (*it >= reference_count) {
+				throw file_read_exception("Read failed [reference frame out of range]");
+			}
+		}
+	}
+
+	/**
+	 * 動きベクトル場の書き込み
+	 *
+	 * @param filename 書き込みファイル
+	 * @param field 動きベクトル場
+	 * @param coding 符号化方式
+	 * @return 書き込みの成功
+	 */
+	inline
+	bool write_mv_field (
+		const std::string &filename,
+		const mv_field &field,
+		const mv_coding coding = mv_coding::fixed )
+	{
+		return write_bytes(filename, encode_mv_field(field, coding));
+	}
+
+	/**
+	 * 動きベクトル場の読み込み
+	 *
+	 * 予測画像は prediction(premap, field.vectors, field.block_size) で再構成できる
+	 *
+	 * @param filename 読み込みファイル
+	 * @return 動きベクトル場
+	 */
+	inline
+	mv_field read_mv_field (const std::string &filename)
+	{
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (in.fail()) {
+			throw file_open_exception("Can't open " + filename);
+		}
+
+		std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (in.bad()) {
+			throw file_read_exception("Read failed [" + filename + "]");
+		}
+
+		return decode_mv_field(data);
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,159 @@
+#ifndef _IMAGE_PADDED_
+#define _IMAGE_PADDED_
+
+#include <algorithm>
+#include <cassert>
+#include "container.hpp"
+#include "cached.hpp"
+#include "integral.hpp"
+#include "sad.hpp"
+
+namespace Image
+{
+	/**
+	 * 周囲を拡張した画像
+	 *
+	 * 上下左右を margin 画素ずつ端の画素で埋めて拡張する
+	 * 座標は元画像の左上を原点とし、負の座標や画像外の座標も参照できる
+	 */
+	template <typename T>
+	class padded
+	{
+	public:
+		typedef T value_type;
+		typedef typename sad_traits<T>::type sum_type;
+
+	private:
+		unsigned int _width;
+		unsigned int _height;
+		unsigned int _margin;
+		container<T> _image;
+		cached<integral_image<sum_type>> _integral;
+
+	public:
+		typedef typename container<T>::const_reference const_reference;
+
+		/**
+		 * コンストラクタ
+		 *
+		 * @param image 元画像
+		 * @param margin 拡張する画素数
+		 */
+		template <typename Map>
+		padded (const Map &image, const unsigned int margin)
+			: _width(image.width()), _height(image.height()), _margin(margin),
+			  _image(image.width() + 2*margin, image.height() + 2*margin,
+			         container<T>::aligned_stride(image.width() + 2*margin))
+		{
+			int m = margin;
+			for (int y = -m; y < static_cast<int>(_height) + m; ++y) {
+				int sy = std::min(std::max(y, 0), static_cast<int>(_height) - 1);
+				for (int x = -m; x < static_cast<int>(_width) + m; ++x) {
+					int sx = std::min(std::max(x, 0), static_cast<int>(_width) - 1);
+					_image(x+m, y+m) = image(sx, sy);
+				}
+			}
+		}
+
+		/**
+		 * 横幅の取得
+		 *
+		 * @return 元画像の横幅
+		 */
+		inline
+		int width () const
+		{
+			return _width;
+		}
+
+		/**
+		 * 縦幅の取得
+		 *
+		 * @return 元画像の縦幅
+		 */
+		inline
+		int height () const
+		{
+			return _height;
+		}
+
+		/**
+		 * 拡張画素数の取得
+		 *
+		 * @return 上下左右に拡張した画素数
+		 */
+		inline
+		int margin () const
+		{
+			return _margin;
+		}
+
+		/**
+		 * 行ピッチの取得
+		 *
+		 * @return 1行あたりの要素数
+		 */
+		inline
+		int stride () const
+		{
+			return _image.stride();
+		}
+
+		/**
+		 * 要素参照
+		 *
+		 * @param x 横方向インデックス (-margin 〜 width+margin-1)
+		 * @param y 縦方向インデックス (-margin 〜 height+margin-1)
+		 * @return 要素参照
+		 */
+		inline
+		const_reference
+		operator() (const int x, const int y) const
+		{
+			return _image(x + _margin, y + _margin);
+		}
+
+		/**
+		 * 積分画像の取得
+		 *
+		 * 拡張した範囲を含めて作成する
+		 *
+		 * @return 積分画像
+		 */
+		const integral_image<sum_type>& integral () const
+		{
+			return _integral.get([this] {
+				return integral_image<sum_type>(*this, _margin);
+			});
+		}
+	};
+
+	/**
+	 * 画像外に参照できる画素数
+	 *
+	 * @param image 画像
+	 * @return 0
+	 */
+	template <typename T>
+	inline
+	int edge_margin (const container<T> &/*image*/)
+	{
+		return 0;
+	}
+
+	/**
+	 * 画像外に参照できる画素数
+	 *
+	 * @param image 拡張画像
+	 * @return 拡張画素数
+	 */
+	template <typename T>
+	inline
+	int edge_margin (const padded<T> &image)
+	{
+		return image.margin();
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,398 @@
+#ifndef _IMAGE_PARTITION_
+#define _IMAGE_PARTITION_
+
+#include <limits>
+#include <algorithm>
+#include <cstdlib>
+#include <type_traits>
+#include "container.hpp"
+#include "sad.hpp"
+#include "thread.hpp"
+#include "algorithm.hpp"
+
+namespace Image
+{
+	/**
+	 * ブロックの分割形状
+	 *
+	 * 16x16 のマクロブロックは 16x16, 16x8, 8x16, 8x8 に分割し、
+	 * 8x8 に分割した場合は 8x8 の領域毎にさらに 8x8, 8x4, 4x8, 4x4 に分割する
+	 */
+	enum class partition : unsigned char
+	{
+		p16x16,
+		p16x8,
+		p8x16,
+		p8x8,
+		p8x4,
+		p4x8,
+		p4x4
+	};
+
+	/**
+	 * 可変ブロックサイズの探索結果
+	 *
+	 * 分割形状は 8x8 の領域毎に、その領域を覆う分割の形状を保持する
+	 * 動きベクトルは 4x4 の部分ブロック毎に保持するため、
+	 * ブロックのサイズ 4 の動きベクトル場としてそのまま予測画像の作成に使える
+	 */
+	struct partition_field
+	{
+		container<partition> modes;
+		ve_container vectors;
+	};
+
+	namespace search
+	{
+		/**
+		 * 検出アルゴリズム variable block size (full search)
+		 *
+		 * 候補毎に 4x4 の部分ブロックの差分絶対値和を1度だけ計算し、
+		 * その和から 16x16 〜 4x4 の全ての分割ブロックの差分絶対値和を求めて
+		 * 分割ブロック毎の最良の動きベクトルを1回の探索で同時に求める
+		 * 分割形状は差分絶対値和に動きベクトル1本あたり split_cost を加えたコストで選ぶため、
+		 * 分割による差分絶対値和の減少が増えた動きベクトルの分を上回る場合だけ分割する
+		 * 16x16 の動きベクトルは full search と一致する
+		 */
+		struct variable_block : public _base_search_algorithm
+		{
+			enum : unsigned int
+			{
+				macro_block_size = 16,
+				sub_block_size = 4
+			};
+
+			//動きベクトル1本あたりのコスト
+			unsigned int split_cost;
+
+			/**
+			 * マクロブロック1個の探索結果
+			 */
+			struct result
+			{
+				partition modes[4];   //8x8 の領域毎の分割形状 (ラスタ順)
+				ve_pair vectors[16];  //4x4 の部分ブロック毎の動きベクトル (ラスタ順)
+			};
+
+			/**
+			 * @param split_cost 動きベクトル1本あたりのコスト
+			 */
+			explicit variable_block (const unsigned int split_cost = 64)
+				: split_cost(split_cost)
+			{
+			}
+
+			/**
+			 * @param premap 原画像
+			 * @param crtmap 次画像
+			 * @param x マクロブロック左上 x座標
+			 * @param y マクロブロック左上 y座標
+			 * @param search_size ブロックの探索範囲
+			 * @param info 探索の統計情報
+			 * @return 分割形状と動きベクトル
+			 */
+			template <typename Ref, typename Cur>
+			result operator() (
+				const Ref &premap,
+				const Cur &crtmap,
+				const int x, const int y,
+				const unsigned int search_size,
+				search_info *info ) const
+			{
+				typedef typename sad_traits<typename Cur::value_type>::type sad_type;
+
+				//分割ブロックの番号
+				// 0:16x16, 1-2:16x8, 3-4:8x16, 5-8:8x8,
+				// 9-16:8x4, 17-24:4x8, 25-40:4x4 (8x8 の領域毎、領域内はラスタ順)
+				static const int count_of_blocks = 41;
+				sad_type best[count_of_blocks];
+				ve_pair vec[count_of_blocks];
+				std::fill(best, best + count_of_blocks, std::numeric_limits<sad_type>::max());
+				std::fill(vec, vec + count_of_blocks, ve_pair(0, 0));
+
+				int count = 0;
+				ve_pair lower, upper;
+				clip_search_range(premap, x, y, macro_block_size, search_size, &lower, &upper);
+
+				for (int dy = lower.second; dy <= upper.second; ++dy) {
+					for (int dx = lower.first; dx <= upper.first; ++dx) {
+						++count;
+
+						//4x4 の部分ブロック毎の差分絶対値和
+						sad_type s[16];
+						sub_block_sad(crtmap, x, y, premap, x+dx, y+dy, s,
+						              std::is_same<typename Cur::value_type, unsigned char>());
+
+						//部分ブロックの和から各分割ブロックの差分絶対値和を求める
+						sad_type p[count_of_blocks];
+						for (int q=0; q<4; ++q) {
+							int base = (q >> 1) * 8 + (q & 1) * 2;
+							sad_type a = s[base], b = s[base+1], c = s[base+4], d = s[base+5];
+							p[5+q]      = a + b + c + d;
+							p[9+2*q]    = a + b;
+							p[10+2*q]   = c + d;
+							p[17+2*q]   = a + c;
+							p[18+2*q]   = b + d;
+							p[25+4*q]   = a;
+							p[25+4*q+1] = b;
+							p[25+4*q+2] = c;
+							p[25+4*q+3] = d;
+						}
+						p[1] = p[5] + p[6];
+						p[2] = p[7] + p[8];
+						p[3] = p[5] + p[7];
+						p[4] = p[6] + p[8];
+						p[0] = p[1] + p[2];
+
+						//ベクトル保存
+						for (int k=0; k<count_of_blocks; ++k) {
+							if (best[k] > p[k]) {
+								best[k] = p[k];
+								vec[k] = {dx, dy};
+							}
+						}
+					}
+				}
+
+				//分割形状の決定
+				const sad_type lambda = split_cost;
+				result ret;
+				sad_type sad;
+
+				sad_type cost_8x8 = 0;
+				sad_type sad_8x8 = 0;
+				partition sub_modes[4];
+				for (int q=0; q<4; ++q) {
+					sad_type sub_cost = best[5+q] + lambda;
+					sad_type sub_sad  = best[5+q];
+					sub_modes[q] = partition::p8x8;
+
+					if (best[9+2*q] + best[10+2*q] + 2*lambda < sub_cost) {
+						sub_sad  = best[9+2*q] + best[10+2*q];
+						sub_cost = sub_sad + 2*lambda;
+						sub_modes[q] = partition::p8x4;
+					}
+					if (best[17+2*q] + best[18+2*q] + 2*lambda < sub_cost) {
+						sub_sad  = best[17+2*q] + best[18+2*q];
+						sub_cost = sub_sad + 2*lambda;
+						sub_modes[q] = partition::p4x8;
+					}
+					sad_type sad_4x4 = best[25+4*q] + best[25+4*q+1] + best[25+4*q+2] + best[25+4*q+3];
+					if (sad_4x4 + 4*lambda < sub_cost) {
+						sub_sad  = sad_4x4;
+						sub_cost = sub_sad + 4*lambda;
+						sub_modes[q] = partition::p4x4;
+					}
+
+					cost_8x8 += sub_cost;
+					sad_8x8  += sub_sad;
+				}
+
+				sad_type cost = best[0] + lambda;
+				sad = best[0];
+				fill(&ret, 0, 0, 4, 4, vec[0], partition::p16x16);
+
+				if (best[1] + best[2] + 2*lambda < cost) {
+					sad  = best[1] + best[2];
+					cost = sad + 2*lambda;
+					fill(&ret, 0, 0, 4, 2, vec[1], partition::p16x8);
+					fill(&ret, 0, 2, 4, 2, vec[2], partition::p16x8);
+				}
+				if (best[3] + best[4] + 2*lambda < cost) {
+					sad  = best[3] + best[4];
+					cost = sad + 2*lambda;
+					fill(&ret, 0, 0, 2, 4, vec[3], partition::p8x16);
+					fill(&ret, 2, 0, 2, 4, vec[4], partition::p8x16);
+				}
+				if (cost_8x8 < cost) {
+					sad = sad_8x8;
+					for (int q=0; q<4; ++q) {
+						int bx = (q & 1) * 2;
+						int by = (q >> 1) * 2;
+						switch (sub_modes[q]) {
+						case partition::p8x4:
+							fill(&ret, bx, by,   2, 1, vec[9+2*q],  partition::p8x4);
+							fill(&ret, bx, by+1, 2, 1, vec[10+2*q], partition::p8x4);
+							break;
+						case partition::p4x8:
+							fill(&ret, bx,   by, 1, 2, vec[17+2*q], partition::p4x8);
+							fill(&ret, bx+1, by, 1, 2, vec[18+2*q], partition::p4x8);
+							break;
+						case partition::p4x4:
+							fill(&ret, bx,   by,   1, 1, vec[25+4*q],   partition::p4x4);
+							fill(&ret, bx+1, by,   1, 1, vec[25+4*q+1], partition::p4x4);
+							fill(&ret, bx,   by+1, 1, 1, vec[25+4*q+2], partition::p4x4);
+							fill(&ret, bx+1, by+1, 1, 1, vec[25+4*q+3], partition::p4x4);
+							break;
+						default:
+							fill(&ret, bx, by, 2, 2, vec[5+q], partition::p8x8);
+							break;
+						}
+					}
+				}
+
+				//回数の保存 (候補毎に全行を評価する)
+				if (info != nullptr) {
+					info->match = count;
+					info->rows  = count * macro_block_size;
+					info->cost  = sad;
+				}
+
+				return ret;
+			}
+
+		private:
+			/**
+			 * 分割ブロックの動きベクトルと分割形状の設定
+			 *
+			 * @param ret 探索結果
+			 * @param bx 分割ブロック左上 x座標 (4x4 の部分ブロック単位)
+			 * @param by 分割ブロック左上 y座標 (4x4 の部分ブロック単位)
+			 * @param bw 分割ブロックの横幅 (4x4 の部分ブロック単位)
+			 * @param bh 分割ブロックの縦幅 (4x4 の部分ブロック単位)
+			 * @param v 動きベクトル
+			 * @param mode 分割形状
+			 */
+			static void fill (
+				result *ret,
+				const int bx, const int by,
+				const int bw, const int bh,
+				const ve_pair &v,
+				const partition mode )
+			{
+				for (int iy=by; iy<by+bh; ++iy) {
+					for (int ix=bx; ix<bx+bw; ++ix) {
+						ret->vectors[iy*4 + ix] = v;
+						ret->modes[(iy >> 1)*2 + (ix >> 1)] = mode;
+					}
+				}
+			}
+
+			/**
+			 * 4x4 の部分ブロック毎の差分絶対値和 (汎用)
+			 */
+			template <typename Map1, typename Map2, typename S>
+			void sub_block_sad (
+				const Map1 &map1, const int x1, const int y1,
+				const Map2 &map2, const int x2, const int y2,
+				S *sums,
+				std::false_type ) const
+			{
+				for (int by=0; by<4; ++by) {
+					for (int bx=0; bx<4; ++bx) {
+						S sum = 0;
+						for (int iy=by*4; iy<by*4+4; ++iy) {
+							for (int ix=bx*4; ix<bx*4+4; ++ix) {
+								sum += std::abs(map1(x1+ix, y1+iy) - map2(x2+ix, y2+iy));
+							}
+						}
+						sums[by*4 + bx] = sum;
+					}
+				}
+			}
+
+			/**
+			 * 4x4 の部分ブロック毎の差分絶対値和 (8bit画素)
+			 */
+			template <typename Map1, typename Map2>
+			void sub_block_sad (
+				const Map1 &map1, const int x1, const int y1,
+				const Map2 &map2, const int x2, const int y2,
+				unsigned int *sums,
+				std::true_type ) const
+			{
+				static const sad::grid_kernel_type k = sad::grid_kernel();
+				k(&map1(x1, y1), map1.stride(), &map2(x2, y2), map2.stride(), sums);
+			}
+		};
+
+		/**
+		 * 画像外の動きベクトルを許す場合の参照画像の拡張画素数 (variable block size)
+		 *
+		 * @param search_size ブロックの探索範囲
+		 * @return 参照画像の拡張画素数
+		 */
+		inline
+		unsigned int variable_block_margin (const unsigned int search_size)
+		{
+			return variable_block::macro_block_size + search_size;
+		}
+	}
+
+	/**
+	 * 可変ブロックサイズの動きベクトル検出
+	 *
+	 * 16x16 のマクロブロックの行単位で並列に探索する
+	 *
+	 * @param premap 原画像 (画像外を参照する場合は拡張画像)
+	 * @param crtmap 次画像
+	 * @param search_size ブロックの探索範囲
+	 * @param func 検出アルゴリズム
+	 * @param info マクロブロック当たりの平均統計情報
+	 * @param pool 並列実行に使用するスレッドプール (nullptr:逐次実行)
+	 * @return 分割形状と動きベクトル
+	 */
+	template <typename Ref, typename Cur>
+	partition_field variable_block_search (
+		const Ref &premap,
+		const Cur &crtmap,
+		const unsigned int search_size,
+		const search::variable_block &func,
+		search_info *info,
+		thread_pool *pool = nullptr )
+	{
+		const int mbs = search::variable_block::macro_block_size;
+		const int mw = crtmap.width()  / mbs;
+		const int mh = crtmap.height() / mbs;
+
+		partition_field field;
+		field.modes   = container<partition>(mw * 2, mh * 2);
+		field.vectors = ve_container(mw * 4, mh * 4);
+
+		//マクロブロック毎の統計情報
+		container<search_info> count(mw, mh);
+
+		//1行分の探索
+		auto search_row = [&](int my) {
+			for (int mx=0; mx < mw; ++mx) {
+				search::variable_block::result r = func(
+					premap, crtmap, mx * mbs, my * mbs, search_size, &count(mx, my));
+
+				for (int i=0; i<16; ++i) {
+					field.vectors(mx*4 + (i & 3), my*4 + (i >> 2)) = r.vectors[i];
+				}
+				for (int q=0; q<4; ++q) {
+					field.modes(mx*2 + (q & 1), my*2 + (q >> 1)) = r.modes[q];
+				}
+			}
+		};
+
+		if (pool != nullptr) {
+			pool->parallel_for(0, mh, search_row);
+		}
+		else {
+			for (int my=0; my < mh; ++my) {
+				search_row(my);
+			}
+		}
+
+		//平均の保存
+		if (info != nullptr) {
+			search_info sum;
+			for (auto it = count.begin(); it != count.end(); ++it) {
+				sum += *it;
+			}
+			//マクロブロックが無い (画像が 16 画素未満) 場合は 0 のまま
+			if (mw > 0 && mh > 0) {
+				sum /= mw;
+				sum /= mh;
+			}
+			*info = sum;
+		}
+
+		return field;
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,278 @@
+#ifndef _IMAGE_PREFETCH_
+#define _IMAGE_PREFETCH_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <exception>
+
+#include "container.hpp"
+#include "frame.hpp"
+
+namespace Image
+{
+	/**
+	 * フレームの先読み
+	 *
+	 * 専用スレッドで次の depth フレームを読み込み、探索と I/O を重ねる
+	 * 読み込み先の画素領域は、返したフレームが破棄された時点で回収して再利用する
+	 * 読み込みを待った時間を記録し、I/O 律速かどうかの判断に使えるようにする
+	 */
+	template <typename T>
+	class frame_prefetcher
+	{
+	public:
+		/**
+		 * 読み込み処理の関数型
+		 *
+		 * index 番目のフレームを buffer に読み込み、入力の終端では false を返す
+		 * buffer は再利用された領域で、大きさが異なる場合は作り直してよい
+		 */
+		typedef std::function<bool (const unsigned int index, container<T> &buffer)> loader_type;
+
+		/**
+		 * フレーム数が不明な入力 (ストリーム) に指定するフレーム数
+		 */
+		static const unsigned int unbounded = static_cast<unsigned int>(-1);
+
+	private:
+		/**
+		 * 読み込み済みのフレーム
+		 */
+		struct item
+		{
+			container<T> buffer;
+			std::exception_ptr error;
+			bool end;
+		};
+
+		/**
+		 * 読み込みスレッドと共有する状態
+		 *
+		 * 返したフレームの破棄時にも参照するため、先読み自体より長く生存し得る
+		 */
+		struct state
+		{
+			std::mutex mutex;
+			std::condition_variable cond;
+			std::deque<item> ready;
+			std::vector<container<T>> unused;
+			bool stop;
+		};
+
+		std::shared_ptr<state> _state;
+		loader_type _load;
+		unsigned int _count;
+		unsigned int _depth;
+		unsigned int _next;
+		bool _end;
+		unsigned int _stalls;
+		double _stall_time;
+		std::thread _thread;
+
+	public:
+		/**
+		 * コンストラクタ
+		 *
+		 * @param count フレーム数 (unbounded:読み込み処理が終端を返すまで)
+		 * @param load 読み込み処理
+		 * @param depth 先読みするフレーム数 (0:先読みせず next の呼び出し時に読み込む)
+		 */
+		frame_prefetcher (const unsigned int count, loader_type load, const unsigned int depth = 2)
+			: _state(std::make_shared<state>()), _load(std::move(load)),
+			  _count(count), _depth(depth), _next(0), _end(false), _stalls(0), _stall_time(0)
+		{
+			_state->stop = false;
+			if (_depth > 0) {
+				_thread = std::thread([this] { run(); });
+			}
+		}
+
+		/**
+		 * デストラクタ
+		 *
+		 * 読み込み中のフレームの完了を待って終了する
+		 */
+		~frame_prefetcher ()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_state->mutex);
+				_state->stop = true;
+			}
+			_state->cond.notify_all();
+			if (_thread.joinable()) {
+				_thread.join();
+			}
+		}
+
+		frame_prefetcher (const frame_prefetcher&) = delete;
+		frame_prefetcher& operator= (const frame_prefetcher&) = delete;
+
+		/**
+		 * 次のフレームの取得
+		 *
+		 * 読み込みが終わっていなければ待機し、待機時間を記録する
+		 * 読み込み処理の例外はここで再送出する
+		 *
+		 * @return フレーム (nullptr:全て取得済み)
+		 */
+		std::shared_ptr<const frame<T>> next ()
+		{
+			if (_end || _next >= _count) {
+				return nullptr;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			bool waited = true;
+			item current;
+			current.end = false;
+
+			if (_depth == 0) {
+				//先読みしない場合は全て待機時間とする
+				current.buffer = take_unused();
+				try {
+					current.end = !_load(_next, current.buffer);
+				}
+				catch (...) {
+					current.error = std::current_exception();
+				}
+			}
+			else {
+				std::unique_lock<std::mutex> lock(_state->mutex);
+				waited = _state->ready.empty();
+				if (waited) {
+					_state->cond.wait(lock, [this] { return !_state->ready.empty(); });
+				}
+				current = std::move(_state->ready.front());
+				_state->ready.pop_front();
+			}
+			_state->cond.notify_all();
+
+			_stall_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			//読み込みに失敗した以降のフレームは返さない
+			if (current.error) {
+				_end = true;
+				std::rethrow_exception(current.error);
+			}
+			if (current.end) {
+				_end = true;
+				return nullptr;
+			}
+			if (waited) {
+				++_stalls;
+			}
+			++_next;
+
+			//破棄時に画素領域を回収する
+			std::shared_ptr<state> shared = _state;
+			return std::shared_ptr<const frame<T>>(
+				new frame<T>(std::move(current.buffer)),
+				[shared] (const frame<T> *image) {
+					container<T> buffer(std::move(*const_cast<frame<T>*>(image)));
+					delete image;
+					std::lock_guard<std::mutex> lock(shared->mutex);
+					shared->unused.push_back(std::move(buffer));
+				}
+			);
+		}
+
+		/**
+		 * 取得済みのフレーム数の取得
+		 *
+		 * @return フレーム数
+		 */
+		inline
+		unsigned int size () const
+		{
+			return _next;
+		}
+
+		/**
+		 * 読み込みを待った回数の取得
+		 *
+		 * @return 待機回数
+		 */
+		inline
+		unsigned int stalls () const
+		{
+			return _stalls;
+		}
+
+		/**
+		 * 読み込みを待った時間の取得
+		 *
+		 * @return 待機時間の合計 [秒]
+		 */
+		inline
+		double stall_time () const
+		{
+			return _stall_time;
+		}
+
+	private:
+		/**
+		 * 回収済みの画素領域の取り出し
+		 *
+		 * @return 画素領域 (無ければ空のコンテナ)
+		 */
+		container<T> take_unused ()
+		{
+			std::lock_guard<std::mutex> lock(_state->mutex);
+			if (_state->unused.empty()) {
+				return container<T>();
+			}
+			container<T> buffer = std::move(_state->unused.back());
+			_state->unused.pop_back();
+			return buffer;
+		}
+
+		/**
+		 * 読み込みスレッドの処理
+		 */
+		void run ()
+		{
+			for (unsigned int i=0; i<_count; ++i) {
+				//先読み数に空きができるまで待機
+				{
+					std::unique_lock<std::mutex> lock(_state->mutex);
+					_state->cond.wait(lock, [this] {
+						return _state->stop || _state->ready.size() < _depth;
+					});
+					if (_state->stop) {
+						return;
+					}
+				}
+
+				item loaded;
+				loaded.buffer = take_unused();
+				loaded.end = false;
+				try {
+					loaded.end = !_load(i, loaded.buffer);
+				}
+				catch (...) {
+					loaded.error = std::current_exception();
+				}
+
+				bool failed = loaded.end || static_cast<bool>(loaded.error);
+				{
+					std::lock_guard<std::mutex> lock(_state->mutex);
+					_state->ready.push_back(std::move(loaded));
+				}
+				_state->cond.notify_all();
+
+				if (failed) {
+					return;
+				}
+			}
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,206 @@
+#ifndef _IMAGE_REFERENCE_
+#define _IMAGE_REFERENCE_
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+#include "container.hpp"
+#include "frame.hpp"
+#include "algorithm.hpp"
+#include "utils.hpp"
+
+namespace Image
+{
+	/**
+	 * 参照フレームの環状バッファ
+	 *
+	 * 直近の capacity フレームを保持し、追加時に最も古いフレームを破棄する
+	 * フレームは派生データ (拡張画像、画像ピラミッド、積分画像など) を保持したまま残るため、
+	 * 同じ参照フレームを複数の対象画像から参照しても派生データは一度だけ作成される
+	 * 複製はフレームを共有する
+	 */
+	template <typename T>
+	class reference_ring
+	{
+	public:
+		typedef std::shared_ptr<const frame<T>> pointer;
+
+	private:
+		std::vector<pointer> _frames;
+		unsigned int _head;
+		unsigned int _size;
+
+	public:
+		/**
+		 * コンストラクタ
+		 *
+		 * @param capacity 保持するフレーム数 (1以上)
+		 */
+		explicit reference_ring (const unsigned int capacity = 1)
+			: _frames(std::max(capacity, 1u)), _head(0), _size(0)
+		{
+		}
+
+		/**
+		 * フレームの追加
+		 *
+		 * 保持数を超える場合は最も古いフレームを破棄する
+		 *
+		 * @param image 追加するフレーム (最新の参照フレームになる)
+		 */
+		void push (pointer image)
+		{
+			_head = (_head + 1) % _frames.size();
+			_frames[_head] = std::move(image);
+			_size = std::min<unsigned int>(_size + 1, _frames.size());
+		}
+
+		/**
+		 * 参照フレームの取得
+		 *
+		 * @param index 新しい順の番号 (0:直前のフレーム)
+		 * @return 参照フレーム
+		 */
+		inline
+		const frame<T>& operator[] (const unsigned int index) const
+		{
+			assert(index < _size);
+			return *_frames[(_head + _frames.size() - index) % _frames.size()];
+		}
+
+		/**
+		 * 保持しているフレーム数の取得
+		 *
+		 * @return フレーム数
+		 */
+		inline
+		unsigned int size () const
+		{
+			return _size;
+		}
+
+		/**
+		 * 保持できるフレーム数の取得
+		 *
+		 * @return フレーム数
+		 */
+		inline
+		unsigned int capacity () const
+		{
+			return _frames.size();
+		}
+	};
+
+	/**
+	 * ブロック毎の参照フレームの選択
+	 *
+	 * 参照フレーム毎の予測画像のうち、ブロック毎に対象画像との差分絶対値和が最小のものを選ぶ
+	 * 差分絶対値和が等しい場合は新しい参照フレームを選ぶ
+	 *
+	 * @param predictions 参照フレーム毎の予測画像 (新しい順)
+	 * @param crtmap 対象画像
+	 * @param width 横方向のブロック数
+	 * @param height 縦方向のブロック数
+	 * @param block_size ブロックのサイズ
+	 * @return ブロック毎の参照フレームの番号
+	 */
+	template <typename T>
+	container<unsigned char> select_references (
+		const std::vector<container<T>> &predictions,
+		const container<T> &crtmap,
+		const int width, const int height,
+		const unsigned int block_size )
+	{
+		typedef typename sad_traits<T>::type sad_type;
+
+		assert(predictions.size() <= std::numeric_limits<unsigned char>::max() + 1u);
+
+		container<unsigned char> ret(width, height);
+		const search::_base_search_algorithm metric;
+
+		for (int by=0; by<height; ++by) {
+			for (int bx=0; bx<width; ++bx) {
+				int x = bx * block_size;
+				int y = by * block_size;
+				sad_type best = std::numeric_limits<sad_type>::max();
+
+				for (unsigned int k=0; k<predictions.size(); ++k) {
+					sad_type sad = metric.sum_of_absolute_difference(
+						crtmap, x, y, predictions[k], x, y, block_size, best, nullptr);
+					if (best > sad) {
+						best = sad;
+						ret(bx, by) = k;
+					}
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	/**
+	 * 参照フレーム毎の予測画像の合成
+	 *
+	 * @param predictions 参照フレーム毎の予測画像 (新しい順)
+	 * @param references ブロック毎の参照フレームの番号
+	 * @param block_size ブロックのサイズ
+	 * @return 予測画像
+	 */
+	template <typename T>
+	container<T> compose_references (
+		const std::vector<container<T>> &predictions,
+		const container<unsigned char> &references,
+		const unsigned int block_size )
+	{
+		container<T> mcmap = predictions.front();
+		const typename block_copy<T>::kernel_type copy = block_copy<T>::select(block_size);
+
+		for (int by=0; by<references.height(); ++by) {
+			for (int bx=0; bx<references.width(); ++bx) {
+				unsigned int k = references(bx, by);
+				assert(k < predictions.size());
+				if (k == 0) {
+					continue;
+				}
+
+				int x = bx * block_size;
+				int y = by * block_size;
+				copy (
+					&predictions[k](x, y), predictions[k].stride(),
+					&mcmap(x, y), mcmap.stride(),
+					block_size, block_size );
+			}
+		}
+
+		return mcmap;
+	}
+
+	/**
+	 * 参照フレーム毎の動きベクトルの選択
+	 *
+	 * @param fields 参照フレーム毎の動きベクトルコンテナ (新しい順)
+	 * @param references ブロック毎の参照フレームの番号
+	 * @return 選んだ参照フレームの動きベクトルのコンテナ
+	 */
+	template <typename E>
+	container<std::pair<E, E>> select_vectors (
+		const std::vector<container<std::pair<E, E>>> &fields,
+		const container<unsigned char> &references )
+	{
+		container<std::pair<E, E>> ret(references.width(), references.height());
+
+		for (int by=0; by<references.height(); ++by) {
+			for (int bx=0; bx<references.width(); ++bx) {
+				assert(references(bx, by) < fields.size());
+				ret(bx, by) = fields[references(bx, by)](bx, by);
+			}
+		}
+
+		return ret;
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,175 @@
+#ifndef _IMAGE_REGISTRY_
+#define _IMAGE_REGISTRY_
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "container.hpp"
+#include "frame.hpp"
+#include "thread.hpp"
+#include "algorithm.hpp"
+#include "partition.hpp"
+
+namespace Image
+{
+	/**
+	 * 検出アルゴリズムの実行時登録表
+	 *
+	 * 検出アルゴリズムを名前で選択できるよう、
+	 * 動きベクトル検出の呼び出しを型消去して保持する
+	 */
+	template <typename T>
+	class search_registry
+	{
+	public:
+		/**
+		 * 動きベクトル検出の関数型
+		 *
+		 * premap, crtmap, macro_block_size, search_size,
+		 * unrestricted (画像外の動きベクトルを許す), previous (前の組の動きベクトル),
+		 * info, pool の順に受け取る
+		 */
+		typedef std::function<ve_container (
+			const frame<T> &, const frame<T> &,
+			const unsigned int, const unsigned int,
+			const bool, const ve_container *,
+			search_info *, thread_pool * )> function_type;
+
+		/**
+		 * 登録項目
+		 */
+		struct entry
+		{
+			//選択に使う名前
+			std::string key;
+
+			//表示名
+			std::string name;
+
+			//動きベクトル検出
+			function_type search;
+
+			//画像外の動きベクトルを許す場合の参照画像の拡張画素数
+			std::function<unsigned int (const unsigned int, const unsigned int)> margin;
+
+			//動きベクトル1本あたりのブロックのサイズ (0:マクロブロックのサイズ)
+			unsigned int vector_block_size;
+		};
+
+	private:
+		std::vector<entry> _entries;
+
+	public:
+		/**
+		 * 検出アルゴリズムの登録
+		 *
+		 * @param key 選択に使う名前
+		 * @param name 表示名
+		 * @param func 検出アルゴリズム
+		 */
+		template <typename Search>
+		void add (const std::string &key, const std::string &name, const Search &func)
+		{
+			function_type search = [func] (
+				const frame<T> &premap, const frame<T> &crtmap,
+				const unsigned int macro_block_size, const unsigned int search_size,
+				const bool unrestricted, const ve_container *previous,
+				search_info *info, thread_pool *pool )
+			{
+				auto f = search::with_previous(func, previous);
+				if (unrestricted) {
+					return motion_vector_search(premap, crtmap, macro_block_size, search_size,
+						search::unrestricted<decltype(f)>(f), info, pool);
+				}
+				return motion_vector_search(premap, crtmap, macro_block_size, search_size,
+					f, info, pool);
+			};
+
+			_entries.push_back({key, name, search, &search::unrestricted<Search>::margin, 0});
+		}
+
+		/**
+		 * 可変ブロックサイズの検出アルゴリズムの登録
+		 *
+		 * マクロブロックのサイズは 16 に固定され、動きベクトルは 4x4 の部分ブロック毎に返す
+		 *
+		 * @param key 選択に使う名前
+		 * @param name 表示名
+		 * @param func 検出アルゴリズム
+		 */
+		void add (const std::string &key, const std::string &name, const search::variable_block &func)
+		{
+			function_type search = [func] (
+				const frame<T> &premap, const frame<T> &crtmap,
+				const unsigned int, const unsigned int search_size,
+				const bool unrestricted, const ve_container *,
+				search_info *info, thread_pool *pool )
+			{
+				if (unrestricted) {
+					return variable_block_search(premap.padded(search::variable_block_margin(search_size)),
+						crtmap, search_size, func, info, pool).vectors;
+				}
+				return variable_block_search(premap, crtmap, search_size, func, info, pool).vectors;
+			};
+
+			auto margin = [] (const unsigned int, const unsigned int search_size) {
+				return search::variable_block_margin(search_size);
+			};
+
+			_entries.push_back({key, name, search, margin, search::variable_block::sub_block_size});
+		}
+
+		/**
+		 * 検出アルゴリズムの検索
+		 *
+		 * @param key 選択に使う名前
+		 * @return 登録項目 (nullptr:未登録)
+		 */
+		const entry* find (const std::string &key) const
+		{
+			for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+				if (it->key == key) {
+					return &*it;
+				}
+			}
+			return nullptr;
+		}
+
+		/**
+		 * 登録項目の一覧
+		 *
+		 * @return 登録順の登録項目
+		 */
+		const std::vector<entry>& entries () const
+		{
+			return _entries;
+		}
+	};
+
+	/**
+	 * 組み込みの検出アルゴリズムを登録した登録表
+	 *
+	 * @return 登録表
+	 */
+	template <typename T>
+	search_registry<T> default_search_registry ()
+	{
+		search_registry<T> registry;
+		registry.add("full", "Full Search",                       search::full());
+		registry.add("tss",  "Three Step Search",                 search::three_step());
+		registry.add("gs",   "Greedy Search",                     search::greedy());
+		registry.add("ds",   "Diamond Search",                    search::diamond());
+		registry.add("hex",  "Hexagon-based Search",              search::hexagon());
+		registry.add("sea",  "Successive Elimination",            search::successive_elimination());
+		registry.add("msea", "Multilevel Successive Elimination", search::successive_elimination(2));
+		registry.add("hier", "Hierarchical Search",               search::hierarchical(2));
+		registry.add("pds",  "Predictive Diamond Search",         search::predictive<search::diamond>());
+		registry.add("phex", "Predictive Hexagon-based Search",   search::predictive<search::hexagon>());
+		registry.add("vbs",  "Variable Block Size Search",        search::variable_block());
+		return registry;
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
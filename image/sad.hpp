@@ -0,0 +1,670 @@
+#ifndef _IMAGE_SAD_
+#define _IMAGE_SAD_
+
+#include <cstdlib>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define IMAGE_SAD_X86
+	#include <emmintrin.h>
+	#include <immintrin.h>
+#endif
+
+namespace Image
+{
+	/**
+	 * 差分絶対値和の累積型
+	 *
+	 * 整数画素は整数で、それ以外は倍精度で累積する
+	 */
+	template <typename T>
+	struct sad_traits
+	{
+		typedef typename std::conditional<
+			std::is_integral<T>::value, unsigned int, double>::type type;
+	};
+
+	/**
+	 * 8bit画素の差分絶対値和 (SAD) カーネル
+	 */
+	namespace sad
+	{
+		/**
+		 * SADカーネルの関数型
+		 *
+		 * @param p1 ブロック1の左上画素
+		 * @param stride1 ブロック1の行ピッチ
+		 * @param p2 ブロック2の左上画素
+		 * @param stride2 ブロック2の行ピッチ
+		 * @param width ブロックの横幅
+		 * @param height ブロックの縦幅
+		 * @return 差分絶対値和
+		 */
+		typedef unsigned int (*kernel_type) (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height );
+
+		/**
+		 * SADカーネル スカラー版
+		 */
+		inline
+		unsigned int scalar (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height )
+		{
+			unsigned int sum = 0;
+
+			for (unsigned int iy=0; iy<height; ++iy, p1 += stride1, p2 += stride2) {
+				for (unsigned int ix=0; ix<width; ++ix) {
+					sum += std::abs(static_cast<int>(p1[ix]) - static_cast<int>(p2[ix]));
+				}
+			}
+
+			return sum;
+		}
+
+		/**
+		 * SADカーネル 固定幅 スカラー版
+		 *
+		 * 横幅をコンパイル時に決めて内側のループを展開する
+		 * 引数の width は W と一致しなければならない
+		 *
+		 * @tparam W ブロックの横幅
+		 */
+		template <unsigned int W>
+		inline
+		unsigned int scalar_fixed (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int /*width*/, const unsigned int height )
+		{
+			unsigned int sum = 0;
+
+			for (unsigned int iy=0; iy<height; ++iy, p1 += stride1, p2 += stride2) {
+				for (unsigned int ix=0; ix<W; ++ix) {
+					sum += std::abs(static_cast<int>(p1[ix]) - static_cast<int>(p2[ix]));
+				}
+			}
+
+			return sum;
+		}
+
+
+		/**
+		 * 4x4 部分ブロック毎のSADカーネルの関数型
+		 *
+		 * 16x16 のブロックを 4x4 の部分ブロックに分割し、
+		 * 部分ブロック毎の差分絶対値和をラスタ順に sums へ保存する
+		 *
+		 * @param p1 ブロック1の左上画素
+		 * @param stride1 ブロック1の行ピッチ
+		 * @param p2 ブロック2の左上画素
+		 * @param stride2 ブロック2の行ピッチ
+		 * @param sums 部分ブロック毎の差分絶対値和の保存先 (16要素)
+		 */
+		typedef void (*grid_kernel_type) (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			unsigned int *sums );
+
+		/**
+		 * 4x4 部分ブロック毎のSADカーネル スカラー版
+		 */
+		inline
+		void grid_scalar (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			unsigned int *sums )
+		{
+			for (unsigned int by=0; by<4; ++by) {
+				for (unsigned int bx=0; bx<4; ++bx) {
+					sums[by*4 + bx] = scalar_fixed<4>(
+						p1 + 4*by*stride1 + 4*bx, stride1,
+						p2 + 4*by*stride2 + 4*bx, stride2, 4, 4);
+				}
+			}
+		}
+
+#ifdef IMAGE_SAD_X86
+		/**
+		 * SADカーネル SSE2版 (psadbw)
+		 */
+		inline
+		unsigned int sse2 (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height )
+		{
+			__m128i acc = _mm_setzero_si128();
+			unsigned int tail = 0;
+
+			for (unsigned int iy=0; iy<height; ++iy, p1 += stride1, p2 += stride2) {
+				unsigned int ix = 0;
+
+				//16画素単位
+				for ( ; ix+16 <= width; ix += 16) {
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1+ix));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p2+ix));
+					acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+				}
+
+				//8画素単位
+				for ( ; ix+8 <= width; ix += 8) {
+					__m128i a = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p1+ix));
+					__m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p2+ix));
+					acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+				}
+
+				//残り
+				for ( ; ix < width; ++ix) {
+					tail += std::abs(static_cast<int>(p1[ix]) - static_cast<int>(p2[ix]));
+				}
+			}
+
+			return tail
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(acc))
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+		}
+
+		/**
+		 * SADカーネル AVX2版
+		 *
+		 * 16画素幅のブロックは2行をまとめて処理する
+		 */
+		__attribute__((target("avx2")))
+		inline
+		unsigned int avx2 (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height )
+		{
+			__m256i acc = _mm256_setzero_si256();
+			unsigned int tail = 0;
+			unsigned int iy = 0;
+
+			if (width == 16) {
+				for ( ; iy+2 <= height; iy += 2, p1 += 2*stride1, p2 += 2*stride2) {
+					__m256i a = _mm256_inserti128_si256(
+						_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1))),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1+stride1)), 1);
+					__m256i b = _mm256_inserti128_si256(
+						_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2))),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2+stride2)), 1);
+					acc = _mm256_add_epi64(acc, _mm256_sad_epu8(a, b));
+				}
+			}
+			else {
+				for ( ; iy < height && width >= 32; ++iy, p1 += stride1, p2 += stride2) {
+					unsigned int ix = 0;
+					for ( ; ix+32 <= width; ix += 32) {
+						__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p1+ix));
+						__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p2+ix));
+						acc = _mm256_add_epi64(acc, _mm256_sad_epu8(a, b));
+					}
+					if (ix < width) {
+						tail += sse2(p1+ix, stride1, p2+ix, stride2, width-ix, 1);
+					}
+				}
+			}
+
+			__m128i sum = _mm_add_epi64(
+				_mm256_castsi256_si128(acc),
+				_mm256_extracti128_si256(acc, 1));
+
+			//残りの行はSSE2版で処理
+			return tail + sse2(p1, stride1, p2, stride2, width, height-iy)
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(sum))
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+		}
+
+		/**
+		 * 4画素の読み込み
+		 */
+		inline
+		__m128i _load4 (const unsigned char *p)
+		{
+			int v;
+			std::memcpy(&v, p, sizeof(v));
+			return _mm_cvtsi32_si128(v);
+		}
+
+		/**
+		 * SADカーネル 固定幅 SSE2版
+		 *
+		 * 横幅 4 / 8 は2行を1レジスタにまとめ、16 / 32 は行毎に展開する
+		 *
+		 * @tparam W ブロックの横幅 (4, 8, 16, 32)
+		 */
+		template <unsigned int W>
+		inline
+		unsigned int sse2_fixed (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int /*width*/, const unsigned int height )
+		{
+			static_assert(W == 4 || W == 8 || W % 16 == 0, "unsupported block width");
+
+			__m128i acc = _mm_setzero_si128();
+			unsigned int iy = 0;
+
+			if (W < 16) {
+				for ( ; iy+2 <= height; iy += 2, p1 += 2*stride1, p2 += 2*stride2) {
+					__m128i a, b;
+					if (W == 4) {
+						a = _mm_unpacklo_epi32(_load4(p1), _load4(p1+stride1));
+						b = _mm_unpacklo_epi32(_load4(p2), _load4(p2+stride2));
+					}
+					else {
+						a = _mm_unpacklo_epi64(
+							_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p1)),
+							_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p1+stride1)));
+						b = _mm_unpacklo_epi64(
+							_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p2)),
+							_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p2+stride2)));
+					}
+					acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+				}
+			}
+			else {
+				for ( ; iy < height; ++iy, p1 += stride1, p2 += stride2) {
+					for (unsigned int ix=0; ix<W; ix += 16) {
+						__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1+ix));
+						__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p2+ix));
+						acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+					}
+				}
+			}
+
+			//奇数行の残り
+			unsigned int tail = (iy < height) ? scalar_fixed<W>(p1, stride1, p2, stride2, W, height-iy) : 0;
+
+			return tail
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(acc))
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+		}
+
+		/**
+		 * SADカーネル 固定幅 AVX2版
+		 *
+		 * 横幅 8 は4行、16 は2行を1レジスタにまとめる
+		 *
+		 * @tparam W ブロックの横幅 (4, 8, 16, 32)
+		 */
+		template <unsigned int W>
+		__attribute__((target("avx2")))
+		inline
+		unsigned int avx2_fixed (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height )
+		{
+			static_assert(W == 4 || W == 8 || W % 16 == 0, "unsupported block width");
+
+			if (W == 4) {
+				return sse2_fixed<W>(p1, stride1, p2, stride2, width, height);
+			}
+
+			__m256i acc = _mm256_setzero_si256();
+			unsigned int iy = 0;
+
+			if (W == 8) {
+				for ( ; iy+4 <= height; iy += 4, p1 += 4*stride1, p2 += 4*stride2) {
+					__m128i a0 = _mm_unpacklo_epi64(
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p1)),
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p1+stride1)));
+					__m128i a1 = _mm_unpacklo_epi64(
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p1+2*stride1)),
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p1+3*stride1)));
+					__m128i b0 = _mm_unpacklo_epi64(
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p2)),
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p2+stride2)));
+					__m128i b1 = _mm_unpacklo_epi64(
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p2+2*stride2)),
+						_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p2+3*stride2)));
+					acc = _mm256_add_epi64(acc, _mm256_sad_epu8(
+						_mm256_inserti128_si256(_mm256_castsi128_si256(a0), a1, 1),
+						_mm256_inserti128_si256(_mm256_castsi128_si256(b0), b1, 1)));
+				}
+			}
+			else if (W == 16) {
+				for ( ; iy+2 <= height; iy += 2, p1 += 2*stride1, p2 += 2*stride2) {
+					__m256i a = _mm256_inserti128_si256(
+						_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1))),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1+stride1)), 1);
+					__m256i b = _mm256_inserti128_si256(
+						_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2))),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2+stride2)), 1);
+					acc = _mm256_add_epi64(acc, _mm256_sad_epu8(a, b));
+				}
+			}
+			else {
+				for ( ; iy < height; ++iy, p1 += stride1, p2 += stride2) {
+					for (unsigned int ix=0; ix<W; ix += 32) {
+						__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p1+ix));
+						__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p2+ix));
+						acc = _mm256_add_epi64(acc, _mm256_sad_epu8(a, b));
+					}
+				}
+			}
+
+			__m128i sum = _mm_add_epi64(
+				_mm256_castsi256_si128(acc),
+				_mm256_extracti128_si256(acc, 1));
+
+			//残りの行はSSE2版で処理
+			unsigned int tail = (iy < height) ? sse2_fixed<W>(p1, stride1, p2, stride2, W, height-iy) : 0;
+
+			return tail
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(sum))
+				+ static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+		}
+
+		/**
+		 * 4x4 部分ブロック毎のSADカーネル SSE2版
+		 *
+		 * 1行16画素を列 0-3, 8-11 と 4-7, 12-15 の2組にマスクして psadbw に渡し、
+		 * 64bitレーン毎に1つの部分ブロックの和を4行分累積する
+		 */
+		inline
+		void grid_sse2 (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			unsigned int *sums )
+		{
+			const __m128i even = _mm_set_epi32(0, -1, 0, -1);
+
+			for (unsigned int by=0; by<4; ++by, sums += 4) {
+				__m128i acc0 = _mm_setzero_si128();
+				__m128i acc1 = _mm_setzero_si128();
+
+				for (unsigned int iy=0; iy<4; ++iy, p1 += stride1, p2 += stride2) {
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p2));
+					acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_and_si128(a, even), _mm_and_si128(b, even)));
+					acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(_mm_andnot_si128(even, a), _mm_andnot_si128(even, b)));
+				}
+
+				sums[0] = _mm_cvtsi128_si32(acc0);
+				sums[1] = _mm_cvtsi128_si32(acc1);
+				sums[2] = _mm_cvtsi128_si32(_mm_srli_si128(acc0, 8));
+				sums[3] = _mm_cvtsi128_si32(_mm_srli_si128(acc1, 8));
+			}
+		}
+
+		/**
+		 * 4x4 部分ブロック毎のSADカーネル AVX2版
+		 *
+		 * SSE2版の2行を1レジスタにまとめ、最後に上下の128bitを足し合わせる
+		 */
+		__attribute__((target("avx2")))
+		inline
+		void grid_avx2 (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			unsigned int *sums )
+		{
+			const __m256i even = _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1);
+
+			for (unsigned int by=0; by<4; ++by, sums += 4) {
+				__m256i acc0 = _mm256_setzero_si256();
+				__m256i acc1 = _mm256_setzero_si256();
+
+				for (unsigned int iy=0; iy<4; iy += 2, p1 += 2*stride1, p2 += 2*stride2) {
+					__m256i a = _mm256_inserti128_si256(
+						_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1))),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1+stride1)), 1);
+					__m256i b = _mm256_inserti128_si256(
+						_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2))),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2+stride2)), 1);
+					acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_and_si256(a, even), _mm256_and_si256(b, even)));
+					acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(_mm256_andnot_si256(even, a), _mm256_andnot_si256(even, b)));
+				}
+
+				__m128i sum0 = _mm_add_epi64(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+				__m128i sum1 = _mm_add_epi64(_mm256_castsi256_si128(acc1), _mm256_extracti128_si256(acc1, 1));
+				sums[0] = _mm_cvtsi128_si32(sum0);
+				sums[1] = _mm_cvtsi128_si32(sum1);
+				sums[2] = _mm_cvtsi128_si32(_mm_srli_si128(sum0, 8));
+				sums[3] = _mm_cvtsi128_si32(_mm_srli_si128(sum1, 8));
+			}
+		}
+#endif
+
+		/**
+		 * CPUに合わせたカーネルの選択
+		 *
+		 * @param name カーネル名の保存先
+		 * @return SADカーネル
+		 */
+		inline
+		kernel_type select (std::string *name = nullptr)
+		{
+#ifdef IMAGE_SAD_X86
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")) {
+				if (name != nullptr) *name = "avx2";
+				return avx2;
+			}
+			if (__builtin_cpu_supports("sse2")) {
+				if (name != nullptr) *name = "sse2";
+				return sse2;
+			}
+#endif
+			if (name != nullptr) *name = "scalar";
+			return scalar;
+		}
+
+		/**
+		 * CPUとブロックの横幅に合わせたカーネルの選択
+		 *
+		 * 横幅 4, 8, 16, 32 は固定幅のカーネル、それ以外は select() と同じカーネルを返す
+		 *
+		 * @param width ブロックの横幅
+		 * @param name カーネル名の保存先
+		 * @return SADカーネル
+		 */
+		inline
+		kernel_type select (const unsigned int width, std::string *name = nullptr)
+		{
+			kernel_type k = select(name);
+			if (width != 4 && width != 8 && width != 16 && width != 32) {
+				return k;
+			}
+			if (name != nullptr) {
+				*name += "/" + std::to_string(width);
+			}
+
+#ifdef IMAGE_SAD_X86
+			if (k == avx2) {
+				switch (width) {
+				case 4:  return avx2_fixed<4>;
+				case 8:  return avx2_fixed<8>;
+				case 16: return avx2_fixed<16>;
+				default: return avx2_fixed<32>;
+				}
+			}
+			if (k == sse2) {
+				switch (width) {
+				case 4:  return sse2_fixed<4>;
+				case 8:  return sse2_fixed<8>;
+				case 16: return sse2_fixed<16>;
+				default: return sse2_fixed<32>;
+				}
+			}
+#endif
+			switch (width) {
+			case 4:  return scalar_fixed<4>;
+			case 8:  return scalar_fixed<8>;
+			case 16: return scalar_fixed<16>;
+			default: return scalar_fixed<32>;
+			}
+		}
+
+		/**
+		 * 横幅に合わせたカーネルの取得
+		 *
+		 * 初回呼び出し時に横幅毎のカーネルを選択しておき、以降は表から引く
+		 *
+		 * @param width ブロックの横幅
+		 * @return SADカーネル
+		 */
+		inline
+		kernel_type kernel_for (const unsigned int width)
+		{
+			static const kernel_type table[] = {
+				select(4u), select(8u), select(16u), select(32u), select()
+			};
+
+			switch (width) {
+			case 4:  return table[0];
+			case 8:  return table[1];
+			case 16: return table[2];
+			case 32: return table[3];
+			default: return table[4];
+			}
+		}
+
+		/**
+		 * CPUに合わせた 4x4 部分ブロック毎のSADカーネルの取得
+		 *
+		 * 初回呼び出し時に選択する
+		 *
+		 * @return 4x4 部分ブロック毎のSADカーネル
+		 */
+		inline
+		grid_kernel_type grid_kernel ()
+		{
+			static const grid_kernel_type k = [] () -> grid_kernel_type {
+#ifdef IMAGE_SAD_X86
+				const kernel_type base = select();
+				if (base == avx2) {
+					return grid_avx2;
+				}
+				if (base == sse2) {
+					return grid_sse2;
+				}
+#endif
+				return grid_scalar;
+			}();
+			return k;
+		}
+
+		/**
+		 * 使用中のカーネル名の取得
+		 *
+		 * @return カーネル名
+		 */
+		inline
+		const std::string& kernel_name ()
+		{
+			static std::string name;
+			static const kernel_type k = select(&name);
+			(void)k;
+			return name;
+		}
+
+		/**
+		 * 差分絶対値和の計算
+		 *
+		 * 横幅 4, 8, 16, 32 は固定幅のカーネルを使用する
+		 *
+		 * @param p1 ブロック1の左上画素
+		 * @param stride1 ブロック1の行ピッチ
+		 * @param p2 ブロック2の左上画素
+		 * @param stride2 ブロック2の行ピッチ
+		 * @param width ブロックの横幅
+		 * @param height ブロックの縦幅
+		 * @return 差分絶対値和
+		 */
+		inline
+		unsigned int compute (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height )
+		{
+			return kernel_for(width)(p1, stride1, p2, stride2, width, height);
+		}
+
+		/**
+		 * 打ち切り付き差分絶対値和の計算
+		 *
+		 * row_group 行ずつ計算し、途中の和が bound 以上になった時点で打ち切る
+		 * 打ち切った場合の戻り値は bound 以上の途中の和となる
+		 *
+		 * @param p1 ブロック1の左上画素
+		 * @param stride1 ブロック1の行ピッチ
+		 * @param p2 ブロック2の左上画素
+		 * @param stride2 ブロック2の行ピッチ
+		 * @param width ブロックの横幅
+		 * @param height ブロックの縦幅
+		 * @param bound 打ち切り値
+		 * @param rows 計算した行数の保存先
+		 * @return 差分絶対値和
+		 */
+		inline
+		unsigned int compute_bounded (
+			const unsigned char *p1, const int stride1,
+			const unsigned char *p2, const int stride2,
+			const unsigned int width, const unsigned int height,
+			const unsigned int bound, unsigned int *rows )
+		{
+			const kernel_type k = kernel_for(width);
+			static const unsigned int row_group = 4;
+
+			unsigned int sum = 0;
+			unsigned int iy = 0;
+
+			while (iy < height) {
+				unsigned int n = (height - iy < row_group) ? height - iy : row_group;
+				sum += k(p1 + iy*stride1, stride1, p2 + iy*stride2, stride2, width, n);
+				iy += n;
+
+				if (sum >= bound) {
+					break;
+				}
+			}
+
+			if (rows != nullptr) {
+				*rows = iy;
+			}
+
+			return sum;
+		}
+
+		/**
+		 * 同じ大きさの2画像の差分絶対値和
+		 *
+		 * マクロブロックと候補位置の参照 (container_view) などをそのまま渡す
+		 *
+		 * @param map1 画像1 (8bit画素)
+		 * @param map2 画像2 (8bit画素)
+		 * @return 差分絶対値和
+		 */
+		template <typename Map1, typename Map2>
+		inline
+		unsigned int compute (const Map1 &map1, const Map2 &map2)
+		{
+			static_assert(
+				std::is_same<typename Map1::value_type, unsigned char>::value &&
+				std::is_same<typename Map2::value_type, unsigned char>::value,
+				"SAD kernel requires 8bit pixels" );
+			assert(map1.width() == map2.width() && map1.height() == map2.height());
+
+			if (map1.width() <= 0 || map1.height() <= 0) {
+				return 0;
+			}
+			return compute (
+				&map1(0, 0), map1.stride(),
+				&map2(0, 0), map2.stride(),
+				map1.width(), map1.height() );
+		}
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
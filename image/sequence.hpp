@@ -0,0 +1,198 @@
+#ifndef _IMAGE_SEQUENCE_
+#define _IMAGE_SEQUENCE_
+
+#include <string>
+#include <cstddef>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io.hpp"
+#include "view.hpp"
+
+namespace Image
+{
+	/**
+	 * 連続フレームファイルの形式
+	 */
+	enum class sequence_format
+	{
+		//輝度のみ
+		raw,
+		//YUV 4:2:0 (Y, U, V の順に平面で格納)
+		yuv420
+	};
+
+	/**
+	 * メモリマップした連続フレームファイル
+	 *
+	 * 同じサイズのフレームを連結した1つのファイルをメモリマップし、
+	 * 各フレームを複製せずに読み込み専用の参照として返す
+	 * フレーム数はファイルサイズとフレームのサイズから求め、
+	 * 末尾の半端なデータは無視する
+	 */
+	template <typename T = unsigned char>
+	class mapped_sequence
+	{
+	private:
+		int _fd;
+		void *_map;
+		std::size_t _length;
+		int _width;
+		int _height;
+		sequence_format _format;
+		std::size_t _frame_size;
+		unsigned int _count;
+
+	public:
+		/**
+		 * コンストラクタ
+		 *
+		 * @param filename 読み込みファイル
+		 * @param width フレームの横幅
+		 * @param height フレームの縦幅
+		 * @param format ファイルの形式
+		 */
+		mapped_sequence (
+			const std::string &filename,
+			const unsigned int width,
+			const unsigned int height,
+			const sequence_format format = sequence_format::raw )
+			: _fd(-1), _map(nullptr), _length(0),
+			  _width(width), _height(height), _format(format),
+			  _frame_size(frame_size(width, height, format)), _count(0)
+		{
+			//読み込みファイルのオープン
+			_fd = ::open(filename.c_str(), O_RDONLY);
+			if (_fd < 0) {
+				throw file_open_exception("Can't open " + filename);
+			}
+
+			struct stat st;
+			if (::fstat(_fd, &st) != 0) {
+				::close(_fd);
+				throw file_read_exception("Read failed [" + filename + "]");
+			}
+			_length = st.st_size;
+			_count  = (_frame_size > 0) ? _length / _frame_size : 0;
+
+			if (_count == 0) {
+				::close(_fd);
+				throw file_read_exception("Read failed [" + filename + "]");
+			}
+
+			//ファイル全体をメモリマップ
+			_map = ::mmap(nullptr, _length, PROT_READ, MAP_PRIVATE, _fd, 0);
+			if (_map == MAP_FAILED) {
+				::close(_fd);
+				throw file_read_exception("Read failed [" + filename + "]");
+			}
+			::madvise(_map, _length, MADV_SEQUENTIAL);
+		}
+
+		/**
+		 * デストラクタ
+		 */
+		~mapped_sequence ()
+		{
+			if (_map != nullptr) {
+				::munmap(_map, _length);
+			}
+			if (_fd >= 0) {
+				::close(_fd);
+			}
+		}
+
+		mapped_sequence (const mapped_sequence&) = delete;
+		mapped_sequence& operator= (const mapped_sequence&) = delete;
+
+		/**
+		 * フレーム数の取得
+		 *
+		 * @return フレーム数
+		 */
+		inline
+		unsigned int size () const
+		{
+			return _count;
+		}
+
+		/**
+		 * 横幅の取得
+		 *
+		 * @return フレームの横幅
+		 */
+		inline
+		int width () const
+		{
+			return _width;
+		}
+
+		/**
+		 * 縦幅の取得
+		 *
+		 * @return フレームの縦幅
+		 */
+		inline
+		int height () const
+		{
+			return _height;
+		}
+
+		/**
+		 * 輝度の取得
+		 *
+		 * @param index フレーム番号
+		 * @return 輝度の参照
+		 */
+		container_view<T> operator[] (const unsigned int index) const
+		{
+			return container_view<T>(frame_data(index), _width, _height, _width);
+		}
+
+		/**
+		 * 色差の取得 (YUV 4:2:0 のみ)
+		 *
+		 * @param index フレーム番号
+		 * @param plane 色差の番号 (0:U, 1:V)
+		 * @return 色差の参照
+		 */
+		container_view<T> chroma (const unsigned int index, const unsigned int plane) const
+		{
+			int w = _width / 2;
+			int h = _height / 2;
+			const T *data = frame_data(index) + _width * _height + plane * w * h;
+			return container_view<T>(data, w, h, w);
+		}
+
+	private:
+		/**
+		 * フレームの先頭
+		 */
+		const T* frame_data (const unsigned int index) const
+		{
+			return reinterpret_cast<const T*>(static_cast<const char*>(_map) + index * _frame_size);
+		}
+
+		/**
+		 * 1フレームのバイト数
+		 */
+		static std::size_t frame_size (
+			const unsigned int width,
+			const unsigned int height,
+			const sequence_format format )
+		{
+			std::size_t luma = static_cast<std::size_t>(width) * height;
+			if (format == sequence_format::yuv420) {
+				luma += 2 * (static_cast<std::size_t>(width / 2) * (height / 2));
+			}
+			return luma * sizeof(T);
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,238 @@
+#ifndef _IMAGE_SUBPEL_
+#define _IMAGE_SUBPEL_
+
+#include <limits>
+#include "container.hpp"
+#include "thread.hpp"
+#include "algorithm.hpp"
+#include "interpolation.hpp"
+#include "utils.hpp"
+
+namespace Image
+{
+	/**
+	 * 1/4 画素単位の値の整数部 (負の値は切り下げる)
+	 *
+	 * @param v 1/4 画素単位の値
+	 * @return 整数部
+	 */
+	inline
+	int subpel_integer (const int v)
+	{
+		return (v >= 0) ? v / interpolation::scale : -((interpolation::scale - 1 - v) / interpolation::scale);
+	}
+
+	/**
+	 * 1/4 画素単位の値の小数部
+	 *
+	 * @param v 1/4 画素単位の値
+	 * @return 小数部 (0 〜 3, 1/4 画素単位)
+	 */
+	inline
+	int subpel_phase (const int v)
+	{
+		return v - subpel_integer(v) * interpolation::scale;
+	}
+
+	namespace search
+	{
+		/**
+		 * 小数画素精度の改良
+		 *
+		 * 整数画素の探索結果を開始点とし、1/2 画素、1/4 画素の順に周囲8点を評価する
+		 * 候補の差分絶対値和は補間済みの位相毎の画像 (subpel_planes) から整数画素と同じカーネルで求め、
+		 * 候補毎には補間しない
+		 * 改良した動きベクトルは 1/4 画素単位となる
+		 */
+		struct subpel : public _base_search_algorithm
+		{
+			//精度 (1:整数画素, 2:1/2 画素, 4:1/4 画素)
+			unsigned int precision;
+
+			/**
+			 * @param precision 精度 (1:整数画素, 2:1/2 画素, 4:1/4 画素)
+			 */
+			explicit subpel (const unsigned int precision = interpolation::scale)
+				: precision(precision)
+			{
+			}
+
+			/**
+			 * @param planes 原画像の小数画素位置の参照画像
+			 * @param crtmap 次画像
+			 * @param x ブロック左上 x座標
+			 * @param y ブロック左上 y座標
+			 * @param block_size ブロックのサイズ
+			 * @param start 整数画素の動きベクトル
+			 * @param info 探索の統計情報
+			 * @return 1/4 画素単位の動きベクトル
+			 */
+			template <typename T, typename Cur>
+			ve_pair operator() (
+				const subpel_planes<T> &planes,
+				const Cur &crtmap,
+				const int x, const int y,
+				const unsigned int block_size,
+				const ve_pair &start,
+				search_info *info ) const
+			{
+				typedef typename sad_traits<typename Cur::value_type>::type sad_type;
+				const int scale = interpolation::scale;
+
+				ve_pair vec(start.first * scale, start.second * scale);
+				sad_type sad = cost(planes, crtmap, x, y, block_size, vec,
+				                    std::numeric_limits<sad_type>::max());
+				int count = 0;
+
+				//1/2 画素、1/4 画素の順に刻みを半分にする
+				for (int step = scale / 2; step >= static_cast<int>(scale / precision) && step > 0; step /= 2) {
+					const ve_pair center = vec;
+					for (int dy = -step; dy <= step; dy += step) {
+						for (int dx = -step; dx <= step; dx += step) {
+							if (dx == 0 && dy == 0) {
+								continue;
+							}
+
+							ve_pair v(center.first + dx, center.second + dy);
+							if (is_over_edge(planes.plane(0, 0),
+							                 x + subpel_integer(v.first), y + subpel_integer(v.second), block_size)) {
+								continue;
+							}
+
+							++count;
+							sad_type sum = cost(planes, crtmap, x, y, block_size, v, sad);
+							if (sad > sum) {
+								sad = sum;
+								vec = v;
+							}
+						}
+					}
+				}
+
+				if (info != nullptr) {
+					info->subpel = count;
+				}
+
+				return vec;
+			}
+
+		private:
+			/**
+			 * 1/4 画素単位の動きベクトルの差分絶対値和 (打ち切り付き)
+			 */
+			template <typename T, typename Cur>
+			typename sad_traits<typename Cur::value_type>::type cost (
+				const subpel_planes<T> &planes,
+				const Cur &crtmap,
+				const int x, const int y,
+				const unsigned int block_size,
+				const ve_pair &v,
+				const typename sad_traits<typename Cur::value_type>::type bound ) const
+			{
+				container_view<T> plane = planes.plane(subpel_phase(v.first), subpel_phase(v.second));
+				return sum_of_absolute_difference (
+					crtmap, x, y,
+					plane, x + subpel_integer(v.first), y + subpel_integer(v.second),
+					block_size, bound, nullptr
+				);
+			}
+		};
+	}
+
+	/**
+	 * 動きベクトル場の小数画素精度の改良
+	 *
+	 * ブロックの行単位で並列に改良する
+	 * 整数画素の動きベクトルは planes の拡張範囲内を指していなければならない
+	 *
+	 * @param planes 原画像の小数画素位置の参照画像
+	 * @param crtmap 次画像
+	 * @param vectors 整数画素の動きベクトル
+	 * @param block_size ブロックのサイズ
+	 * @param func 改良の設定
+	 * @param info ブロック当たりの平均統計情報 (subpel のみ設定する)
+	 * @param pool 並列実行に使用するスレッドプール (nullptr:逐次実行)
+	 * @return 1/4 画素単位の動きベクトル
+	 */
+	template <typename T, typename Cur>
+	ve_container subpel_refinement (
+		const subpel_planes<T> &planes,
+		const Cur &crtmap,
+		const ve_container &vectors,
+		const unsigned int block_size,
+		const search::subpel &func,
+		search_info *info,
+		thread_pool *pool = nullptr )
+	{
+		ve_container ret(vectors.width(), vectors.height());
+		container<search_info> count(vectors.width(), vectors.height());
+
+		//1行分の改良
+		auto refine_row = [&](int cy) {
+			for (int cx=0; cx < vectors.width(); ++cx) {
+				ret(cx, cy) = func(planes, crtmap, cx * block_size, cy * block_size, block_size,
+				                   vectors(cx, cy), &count(cx, cy));
+			}
+		};
+
+		if (pool != nullptr) {
+			pool->parallel_for(0, vectors.height(), refine_row);
+		}
+		else {
+			for (int cy=0; cy < vectors.height(); ++cy) {
+				refine_row(cy);
+			}
+		}
+
+		//平均の保存
+		if (info != nullptr && count.width() > 0 && count.height() > 0) {
+			double sum = 0;
+			for (auto it = count.begin(); it != count.end(); ++it) {
+				sum += it->subpel;
+			}
+			info->subpel = sum / (count.width() * count.height());
+		}
+
+		return ret;
+	}
+
+	/**
+	 * 予測画像の作成 (1/4 画素単位の動きベクトル)
+	 *
+	 * 位相毎の補間済み画像からブロックをコピーする
+	 *
+	 * @param planes 元画像の小数画素位置の参照画像
+	 * @param vec 1/4 画素単位の動きベクトルコンテナ
+	 * @param macro_block_size マクロブロックのサイズ
+	 */
+	template <typename T, typename E>
+	container<T> prediction (
+		const subpel_planes<T> &planes,
+		const container<std::pair<E, E>> &vec,
+		const unsigned int macro_block_size )
+	{
+		container<T> mcmap(planes.width(), planes.height());
+		const typename block_copy<T>::kernel_type copy = block_copy<T>::select(macro_block_size);
+
+		//各マクロブロックごとに処理
+		for (int cy = 0; cy < vec.height(); ++cy) {
+			for (int cx = 0; cx < vec.width(); ++cx) {
+				int dx = vec(cx, cy).first;
+				int dy = vec(cx, cy).second;
+				int x = cx * macro_block_size;
+				int y = cy * macro_block_size;
+
+				container_view<T> plane = planes.plane(subpel_phase(dx), subpel_phase(dy));
+				copy (
+					&plane(x + subpel_integer(dx), y + subpel_integer(dy)), plane.stride(),
+					&mcmap(x, y), mcmap.stride(),
+					macro_block_size, macro_block_size );
+			}
+		}
+
+		return mcmap;
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,297 @@
+#ifndef _IMAGE_THREAD_
+#define _IMAGE_THREAD_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+namespace Image
+{
+	/**
+	 * 固定数スレッドプール (work-stealing)
+	 *
+	 * ワーカー毎にタスクキューを持ち、自分のキューが空になると
+	 * 他のワーカーのキューからタスクを奪って実行する
+	 * タスク内から parallel_for を呼び出して入れ子にしてもよい
+	 */
+	class thread_pool
+	{
+	private:
+		/**
+		 * ワーカー毎のタスクキュー
+		 */
+		struct task_queue
+		{
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		std::vector<std::unique_ptr<task_queue>> _queues;
+		std::vector<std::thread> _workers;
+		std::mutex _mutex;
+		std::condition_variable _cond;
+		std::atomic<unsigned int> _pending;
+		std::atomic<unsigned int> _next;
+		bool _stop;
+
+		/**
+		 * 実行中スレッドの所属
+		 */
+		struct worker_id
+		{
+			const thread_pool *owner;
+			int index;
+		};
+
+		/**
+		 * 実行中スレッドの所属の参照
+		 *
+		 * @return スレッド毎の所属情報
+		 */
+		static worker_id& current ()
+		{
+			static thread_local worker_id id = {nullptr, -1};
+			return id;
+		}
+
+		/**
+		 * 実行中スレッドのワーカー番号
+		 *
+		 * @return ワーカー番号 (-1:プール外のスレッド)
+		 */
+		int current_index () const
+		{
+			return (current().owner == this) ? current().index : -1;
+		}
+
+		/**
+		 * タスクを1つ取り出して実行
+		 *
+		 * 自分のキューの末尾から取り出し、空なら他のキューの先頭から奪う
+		 *
+		 * @return true:タスクを実行した
+		 */
+		bool run_one ()
+		{
+			int self = current_index();
+			unsigned int n = _queues.size();
+			std::function<void()> task;
+
+			for (unsigned int i=0; i<n && !task; ++i) {
+				int k = (self < 0) ? i : (self + i) % n;
+				task_queue &q = *_queues[k];
+				std::lock_guard<std::mutex> lock(q.mutex);
+				if (q.tasks.empty()) {
+					continue;
+				}
+				if (k == self) {
+					task = std::move(q.tasks.back());
+					q.tasks.pop_back();
+				}
+				else {
+					task = std::move(q.tasks.front());
+					q.tasks.pop_front();
+				}
+			}
+
+			if (!task) {
+				return false;
+			}
+
+			--_pending;
+			task();
+			return true;
+		}
+
+		/**
+		 * ワーカースレッドの処理
+		 *
+		 * @param index ワーカー番号
+		 */
+		void worker (int index)
+		{
+			current().owner = this;
+			current().index = index;
+
+			while (true) {
+				if (run_one()) {
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(_mutex);
+				if (_stop && _pending == 0) {
+					return;
+				}
+				_cond.wait(lock, [this] { return _stop || _pending > 0; });
+			}
+		}
+
+	public:
+		/**
+		 * コンストラクタ
+		 *
+		 * 呼び出し元スレッドも処理に参加するため
+		 * ワーカースレッドは threads-1 個生成する
+		 *
+		 * @param threads 並列数 (0:CPUのコア数)
+		 */
+		explicit thread_pool (unsigned int threads = 0)
+			: _pending(0), _next(0), _stop(false)
+		{
+			if (threads == 0) {
+				threads = std::max(1u, std::thread::hardware_concurrency());
+			}
+			for (unsigned int i=1; i<threads; ++i) {
+				_queues.emplace_back(new task_queue);
+			}
+			for (unsigned int i=1; i<threads; ++i) {
+				_workers.emplace_back([this, i] { worker(i-1); });
+			}
+		}
+
+		/**
+		 * デストラクタ
+		 *
+		 * 投入済みのタスクを全て実行してから終了する
+		 */
+		~thread_pool ()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stop = true;
+			}
+			_cond.notify_all();
+			for (auto it = _workers.begin(); it != _workers.end(); ++it) {
+				it->join();
+			}
+		}
+
+		thread_pool (const thread_pool&) = delete;
+		thread_pool& operator= (const thread_pool&) = delete;
+
+		/**
+		 * 並列数の取得
+		 *
+		 * @return 呼び出し元を含むスレッド数
+		 */
+		inline
+		unsigned int size () const
+		{
+			return _workers.size() + 1;
+		}
+
+		/**
+		 * タスクの投入
+		 *
+		 * ワーカーからの投入は自分のキューへ、
+		 * それ以外は各キューへ順番に振り分ける
+		 * ワーカーが無い場合は即座に実行する
+		 *
+		 * @param task 実行する処理
+		 */
+		void submit (std::function<void()> task)
+		{
+			if (_queues.empty()) {
+				task();
+				return;
+			}
+
+			int self = current_index();
+			unsigned int k = (self < 0) ? (_next++ % _queues.size()) : self;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				++_pending;
+			}
+			{
+				std::lock_guard<std::mutex> lock(_queues[k]->mutex);
+				_queues[k]->tasks.push_back(std::move(task));
+			}
+			_cond.notify_one();
+		}
+
+		/**
+		 * 戻り値を持つタスクの投入
+		 *
+		 * @param func 実行する処理
+		 * @return 処理結果の future
+		 */
+		template <typename Function>
+		std::future<typename std::result_of<Function()>::type> async (Function func)
+		{
+			typedef typename std::result_of<Function()>::type result_type;
+
+			auto task = std::make_shared<std::packaged_task<result_type()>>(std::move(func));
+			auto result = task->get_future();
+			submit([task] { (*task)(); });
+
+			return result;
+		}
+
+		/**
+		 * 区間 [begin, end) の並列処理
+		 *
+		 * インデックスは昇順に取り出され、全て終了するまで戻らない
+		 * 待機中は他のタスクの実行を手伝う
+		 *
+		 * @param begin 開始インデックス
+		 * @param end 終了インデックス
+		 * @param func 各インデックスに適用する処理
+		 */
+		void parallel_for (int begin, int end, const std::function<void(int)> &func)
+		{
+			std::atomic<int> next(begin);
+			std::mutex mutex;
+			std::condition_variable cond;
+			unsigned int running = 0;
+
+			//インデックスを取り出して処理
+			auto body = [&] {
+				for (int i = next++; i < end; i = next++) {
+					func(i);
+				}
+			};
+
+			//ワーカーに補助タスクを投入
+			int helpers = std::max(0, std::min<int>(_workers.size(), end - begin - 1));
+			running = helpers;
+			for (int i=0; i<helpers; ++i) {
+				submit([&] {
+					body();
+					std::lock_guard<std::mutex> lock(mutex);
+					if (--running == 0) {
+						cond.notify_one();
+					}
+				});
+			}
+
+			//呼び出し元も処理に参加
+			body();
+
+			//未着手の補助タスクを消化
+			while (true) {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (running == 0) {
+						return;
+					}
+				}
+				if (!run_one()) {
+					break;
+				}
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [&] { return running == 0; });
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
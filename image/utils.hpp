@@ -2,10 +2,78 @@
 #define _IMAGE_UTILS_
 
 #include <utility>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <cassert>
 #include "container.hpp"
+#include "padded.hpp"
 
 namespace Image
 {
+	/**
+	 * ブロックのコピー関数の型
+	 */
+	template <typename T>
+	struct block_copy
+	{
+		typedef void (*kernel_type) (
+			const T *src, const int src_stride,
+			T *dst, const int dst_stride,
+			const unsigned int width, const unsigned int height );
+
+		/**
+		 * ブロックのコピー
+		 */
+		static
+		void copy (
+			const T *src, const int src_stride,
+			T *dst, const int dst_stride,
+			const unsigned int width, const unsigned int height )
+		{
+			for (unsigned int iy = 0; iy < height; ++iy, src += src_stride, dst += dst_stride) {
+				std::copy(src, src + width, dst);
+			}
+		}
+
+		/**
+		 * ブロックのコピー (固定幅)
+		 *
+		 * 行のコピーは固定長となり、コンパイラが展開する
+		 *
+		 * @tparam W ブロックの横幅
+		 */
+		template <unsigned int W>
+		static
+		void copy_fixed (
+			const T *src, const int src_stride,
+			T *dst, const int dst_stride,
+			const unsigned int /*width*/, const unsigned int height )
+		{
+			for (unsigned int iy = 0; iy < height; ++iy, src += src_stride, dst += dst_stride) {
+				std::copy(src, src + W, dst);
+			}
+		}
+
+		/**
+		 * 横幅に合わせたコピー関数の選択
+		 *
+		 * @param width ブロックの横幅
+		 * @return 横幅 4, 8, 16, 32 は固定幅のコピー関数、それ以外は汎用のコピー関数
+		 */
+		static
+		kernel_type select (const unsigned int width)
+		{
+			switch (width) {
+			case 4:  return copy_fixed<4>;
+			case 8:  return copy_fixed<8>;
+			case 16: return copy_fixed<16>;
+			case 32: return copy_fixed<32>;
+			default: return copy;
+			}
+		}
+	};
+
 	/**
 	 * 予測画像の作成
 	 *
@@ -19,7 +87,53 @@ namespace Image
 		const container<std::pair<E, E>> &vec,
 		const unsigned int macro_block_size )
 	{
+		//元画像と同じ行ピッチで作成する
+		container<T> mcmap(premap.width(), premap.height(), premap.stride());
+		const typename block_copy<T>::kernel_type copy = block_copy<T>::select(macro_block_size);
+
+		//各マクロブロックごとに処理
+		for (int cy = 0; cy < vec.height(); ++cy) {
+			for (int cx = 0; cx < vec.width(); ++cx) {
+				E dx = vec(cx, cy).first;
+				E dy = vec(cx, cy).second;
+				int x = cx * macro_block_size;
+				int y = cy * macro_block_size;
+
+				assert(x+dx >= 0 && y+dy >= 0);
+				assert(x+dx+static_cast<int>(macro_block_size) <= premap.width()
+				    && y+dy+static_cast<int>(macro_block_size) <= premap.height());
+
+				copy (
+					&premap(x+dx, y+dy), premap.stride(),
+					&mcmap(x, y), mcmap.stride(),
+					macro_block_size, macro_block_size );
+			}
+		}
+
+		return mcmap;
+	}
+
+	/**
+	 * 予測画像の作成 (拡張画像や参照から)
+	 *
+	 * 拡張した範囲内 (edge_margin) であれば画像外を指す動きベクトルも扱える
+	 *
+	 * @param premap 元画像の拡張画像または参照 (padded, container_view など)
+	 * @param vec 動きベクトルコンテナ
+	 * @param macro_block_size マクロブロックのサイズ
+	 */
+	template <typename Map, typename E>
+	typename std::enable_if<
+		!std::is_base_of<container<typename Map::value_type>, Map>::value,
+		container<typename Map::value_type>>::type
+	prediction (
+		const Map &premap,
+		const container<std::pair<E, E>> &vec,
+		const unsigned int macro_block_size )
+	{
+		typedef typename Map::value_type T;
 		container<T> mcmap(premap.width(), premap.height());
+		const typename block_copy<T>::kernel_type copy = block_copy<T>::select(macro_block_size);
 
 		//各マクロブロックごとに処理
 		for (int cy = 0; cy < vec.height(); ++cy) {
@@ -29,16 +143,48 @@ namespace Image
 				int x = cx * macro_block_size;
 				int y = cy * macro_block_size;
 
-				std::copy (
-					premap, x+dx, y+dy,
-					macro_block_size, macro_block_size,
-					mcmap, x, y );
+				copy (
+					&premap(x+dx, y+dy), premap.stride(),
+					&mcmap(x, y), mcmap.stride(),
+					macro_block_size, macro_block_size );
 			}
 		}
 
 		return mcmap;
 	}
 
+	/**
+	 * 残差画像の作成
+	 *
+	 * 対象画像と予測画像の差に中間値を加えて表示用の画像にする
+	 * 整数画素は画素の範囲に収める
+	 *
+	 * @param crtmap 対象画像
+	 * @param mcmap 予測画像
+	 * @return 残差画像
+	 */
+	template <typename T>
+	container<T> residual (
+		const container<T> &crtmap,
+		const container<T> &mcmap )
+	{
+		typedef typename std::conditional<std::is_integral<T>::value, long, T>::type diff_type;
+
+		const diff_type lower = std::numeric_limits<T>::lowest();
+		const diff_type upper = std::numeric_limits<T>::max();
+		const diff_type offset = std::is_integral<T>::value ? (lower + upper + 1) / 2 : 0;
+
+		container<T> ret(crtmap.width(), crtmap.height());
+		for (int y = 0; y < crtmap.height(); ++y) {
+			for (int x = 0; x < crtmap.width(); ++x) {
+				diff_type d = static_cast<diff_type>(crtmap(x, y)) - mcmap(x, y) + offset;
+				ret(x, y) = static_cast<T>(std::max(lower, std::min(upper, d)));
+			}
+		}
+
+		return ret;
+	}
+
 }
 
 #endif
@@ -0,0 +1,218 @@
+#ifndef _IMAGE_VIEW_
+#define _IMAGE_VIEW_
+
+#include <algorithm>
+#include <cassert>
+
+#include "padded.hpp"
+
+namespace Image
+{
+	/**
+	 * 読み込み専用の画像の参照
+	 *
+	 * 画素を所有せず、外部の領域 (メモリマップしたファイルなど) や
+	 * 他の画像の部分矩形 (マクロブロックや探索窓) を参照する
+	 * 参照先は参照より長く生存しなければならない
+	 * 参照先に矩形の外側の画素がある場合、その画素数を edge_margin として保持し、
+	 * 探索は矩形の外側もその範囲まで参照できる
+	 */
+	template <typename T>
+	class container_view
+	{
+	private:
+		const T *_data;
+		int _width;
+		int _height;
+		int _stride;
+		int _margin;
+
+	public:
+		typedef T value_type;
+		typedef const T* const_iterator;
+
+		/**
+		 * デフォルトコンストラクタ
+		 */
+		container_view ()
+			: _data(nullptr), _width(0), _height(0), _stride(0), _margin(0)
+		{
+		}
+
+		/**
+		 * コンストラクタ
+		 *
+		 * @param data 左上画素
+		 * @param width 横幅
+		 * @param height 縦幅
+		 * @param stride 行ピッチ (画素数)
+		 * @param margin 矩形の外側に参照できる画素数
+		 */
+		container_view (const T *data, const int width, const int height, const int stride, const int margin = 0)
+			: _data(data), _width(width), _height(height), _stride(stride), _margin(margin)
+		{
+		}
+
+		/**
+		 * 画像全体の参照
+		 *
+		 * 空の画像は画素を参照しない
+		 *
+		 * @param map 参照する画像 (container, padded, frame など)
+		 */
+		template <typename Map>
+		explicit container_view (const Map &map)
+			: _data((map.width() > 0 && map.height() > 0) ? &map(0, 0) : nullptr),
+			  _width(map.width()), _height(map.height()),
+			  _stride(map.stride()), _margin(edge_margin(map))
+		{
+		}
+
+		/**
+		 * 部分矩形の参照
+		 *
+		 * 座標は参照する画像の座標とする
+		 * 画像外に参照できる範囲 (edge_margin) まではみ出してもよい
+		 *
+		 * @param map 参照する画像
+		 * @param x 矩形の左上 x座標
+		 * @param y 矩形の左上 y座標
+		 * @param width 矩形の横幅
+		 * @param height 矩形の縦幅
+		 */
+		template <typename Map>
+		container_view (const Map &map, const int x, const int y, const int width, const int height)
+			: _data(&map(x, y)), _width(width), _height(height), _stride(map.stride())
+		{
+			const int m = edge_margin(map);
+			_margin = std::min({
+				x + m, y + m,
+				map.width()  + m - (x + width),
+				map.height() + m - (y + height) });
+			assert(_margin >= 0);
+		}
+
+		/**
+		 * 部分矩形の参照
+		 *
+		 * @param x 矩形の左上 x座標 (この参照の座標)
+		 * @param y 矩形の左上 y座標 (この参照の座標)
+		 * @param width 矩形の横幅
+		 * @param height 矩形の縦幅
+		 * @return 部分矩形の参照
+		 */
+		inline
+		container_view block (const int x, const int y, const int width, const int height) const
+		{
+			return container_view(*this, x, y, width, height);
+		}
+
+		/**
+		 * 横幅の取得
+		 *
+		 * @return 横幅
+		 */
+		inline
+		int width () const
+		{
+			return _width;
+		}
+
+		/**
+		 * 縦幅の取得
+		 *
+		 * @return 縦幅
+		 */
+		inline
+		int height () const
+		{
+			return _height;
+		}
+
+		/**
+		 * 行ピッチの取得
+		 *
+		 * @return 行ピッチ (画素数)
+		 */
+		inline
+		int stride () const
+		{
+			return _stride;
+		}
+
+		/**
+		 * 矩形の外側に参照できる画素数の取得
+		 *
+		 * @return 画素数
+		 */
+		inline
+		int margin () const
+		{
+			return _margin;
+		}
+
+		/**
+		 * 左上画素の取得
+		 *
+		 * @return 左上画素
+		 */
+		inline
+		const T* data () const
+		{
+			return _data;
+		}
+
+		/**
+		 * 画素の取得
+		 *
+		 * @param x x座標
+		 * @param y y座標
+		 * @return 画素
+		 */
+		inline
+		const T& operator() (const int x, const int y) const
+		{
+			return _data[x + y * _stride];
+		}
+
+		/**
+		 * 先頭イテレータの取得
+		 *
+		 * 行ピッチが横幅と等しい場合のみ全画素を走査できる
+		 *
+		 * @return 先頭イテレータ
+		 */
+		inline
+		const_iterator begin () const
+		{
+			return _data;
+		}
+
+		/**
+		 * 末尾イテレータの取得
+		 *
+		 * @return 末尾イテレータ
+		 */
+		inline
+		const_iterator end () const
+		{
+			return _data + _stride * _height;
+		}
+	};
+
+	/**
+	 * 画像外に参照できる画素数
+	 *
+	 * @param image 参照
+	 * @return 矩形の外側に参照できる画素数
+	 */
+	template <typename T>
+	inline
+	int edge_margin (const container_view<T> &image)
+	{
+		return image.margin();
+	}
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
@@ -0,0 +1,147 @@
+#ifndef _IMAGE_WRITER_
+#define _IMAGE_WRITER_
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <utility>
+#include <exception>
+#include <algorithm>
+
+#include "io.hpp"
+
+namespace Image
+{
+	/**
+	 * バックグラウンドでのファイルの書き込み
+	 *
+	 * 呼び出し元で画像をバイト列に変換し、書き込みだけを専用スレッドで行う
+	 * 書き込み待ちの数が上限に達すると、空きができるまで呼び出し元を待たせる
+	 */
+	class background_writer
+	{
+	private:
+		std::mutex _mutex;
+		std::condition_variable _cond;
+		std::deque<std::pair<std::string, std::string>> _queue;
+		unsigned int _max_pending;
+		bool _busy;
+		bool _stop;
+		std::exception_ptr _error;
+		std::thread _thread;
+
+	public:
+		/**
+		 * コンストラクタ
+		 *
+		 * @param max_pending 書き込み待ちの上限
+		 */
+		explicit background_writer (const unsigned int max_pending = 8)
+			: _max_pending(std::max(1u, max_pending)), _busy(false), _stop(false)
+		{
+			_thread = std::thread([this] { run(); });
+		}
+
+		/**
+		 * デストラクタ
+		 *
+		 * 書き込み待ちを全て書き込んでから終了する
+		 */
+		~background_writer ()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stop = true;
+			}
+			_cond.notify_all();
+			_thread.join();
+		}
+
+		background_writer (const background_writer&) = delete;
+		background_writer& operator= (const background_writer&) = delete;
+
+		/**
+		 * バイト列の書き込み
+		 *
+		 * @param filename 書き込みファイル
+		 * @param data 書き込むバイト列
+		 */
+		void write (const std::string &filename, std::string data)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this] { return _queue.size() < _max_pending; });
+			_queue.emplace_back(filename, std::move(data));
+			lock.unlock();
+			_cond.notify_all();
+		}
+
+		/**
+		 * 画像の書き込み (PGM 形式)
+		 *
+		 * @param filename 書き込みファイル
+		 * @param image 書き込むデータ
+		 */
+		template <typename Map>
+		void write_pgm (const std::string &filename, const Map &image)
+		{
+			write(filename, encode_pgm(image));
+		}
+
+		/**
+		 * 書き込みの完了待ち
+		 *
+		 * 書き込みに失敗していた場合は最初の例外を再送出する
+		 */
+		void flush ()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this] { return _queue.empty() && !_busy; });
+			if (_error) {
+				std::exception_ptr error = _error;
+				_error = nullptr;
+				std::rethrow_exception(error);
+			}
+		}
+
+	private:
+		/**
+		 * 書き込みスレッドの処理
+		 */
+		void run ()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (true) {
+				_cond.wait(lock, [this] { return _stop || !_queue.empty(); });
+				if (_queue.empty()) {
+					return;
+				}
+
+				auto item = std::move(_queue.front());
+				_queue.pop_front();
+				_busy = true;
+				lock.unlock();
+				_cond.notify_all();
+
+				std::exception_ptr error;
+				try {
+					write_bytes(item.first, item.second);
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+
+				lock.lock();
+				_busy = false;
+				if (error && !_error) {
+					_error = error;
+				}
+				_cond.notify_all();
+			}
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
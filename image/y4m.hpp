@@ -0,0 +1,163 @@
+#ifndef _IMAGE_Y4M_
+#define _IMAGE_Y4M_
+
+#include <istream>
+#include <string>
+#include <sstream>
+#include <cstddef>
+
+#include "container.hpp"
+#include "io.hpp"
+
+namespace Image
+{
+	/**
+	 * YUV4MPEG2 (Y4M) ストリームの読み込み
+	 *
+	 * 標準入力や名前付きパイプから順に読み込むため、シークは行わない
+	 * 画像サイズはストリームのヘッダから取得し、輝度のみを取り出す
+	 * 8bit の 4:2:0 / 4:2:2 / 4:4:4 / mono に対応する
+	 */
+	class y4m_reader
+	{
+	private:
+		std::istream &_in;
+		int _width;
+		int _height;
+		std::size_t _chroma_size;
+		std::string _skip;
+
+	public:
+		/**
+		 * コンストラクタ
+		 *
+		 * ストリームのヘッダを読み込む
+		 *
+		 * @param in 入力ストリーム
+		 */
+		explicit y4m_reader (std::istream &in)
+			: _in(in), _width(0), _height(0), _chroma_size(0)
+		{
+			std::string header;
+			if (!std::getline(_in, header)) {
+				throw file_read_exception("Read failed [Y4M header]");
+			}
+
+			std::istringstream tokens(header);
+			std::string token;
+			tokens >> token;
+			if (token != "YUV4MPEG2") {
+				throw file_read_exception("Read failed [not a Y4M stream]");
+			}
+
+			std::string chroma = "420jpeg";
+			while (tokens >> token) {
+				switch (token[0]) {
+				case 'W':
+					_width = std::stoi(token.substr(1));
+					break;
+				case 'H':
+					_height = std::stoi(token.substr(1));
+					break;
+				case 'C':
+					chroma = token.substr(1);
+					break;
+				default:
+					break;
+				}
+			}
+
+			if (_width <= 0 || _height <= 0) {
+				throw file_read_exception("Read failed [Y4M frame size]");
+			}
+
+			//色差のバイト数 (読み飛ばす)
+			std::size_t cw = (_width + 1) / 2;
+			std::size_t ch = (_height + 1) / 2;
+			if (chroma == "420" || chroma == "420jpeg" || chroma == "420paldv" || chroma == "420mpeg2") {
+				_chroma_size = 2 * cw * ch;
+			}
+			else if (chroma == "422") {
+				_chroma_size = 2 * cw * _height;
+			}
+			else if (chroma == "444") {
+				_chroma_size = 2 * static_cast<std::size_t>(_width) * _height;
+			}
+			else if (chroma == "mono") {
+				_chroma_size = 0;
+			}
+			else {
+				throw file_read_exception("Read failed [unsupported Y4M colorspace " + chroma + "]");
+			}
+			_skip.resize(_chroma_size);
+		}
+
+		/**
+		 * 横幅の取得
+		 *
+		 * @return フレームの横幅
+		 */
+		inline
+		int width () const
+		{
+			return _width;
+		}
+
+		/**
+		 * 縦幅の取得
+		 *
+		 * @return フレームの縦幅
+		 */
+		inline
+		int height () const
+		{
+			return _height;
+		}
+
+		/**
+		 * 次のフレームの読み込み
+		 *
+		 * コンテナの大きさが異なる場合は作り直す
+		 *
+		 * @param image 輝度の読み込み先
+		 * @return false:ストリームの終端
+		 */
+		bool read (container<unsigned char> &image)
+		{
+			//フレームヘッダ
+			std::string marker;
+			if (!std::getline(_in, marker)) {
+				return false;
+			}
+			if (marker.compare(0, 5, "FRAME") != 0) {
+				throw file_read_exception("Read failed [Y4M frame marker]");
+			}
+
+			if (image.width() != _width || image.height() != _height) {
+				image = container<unsigned char>(_width, _height);
+			}
+
+			//輝度 (行ピッチが横幅と異なる場合は行毎)
+			const int rows = (image.stride() == _width) ? 1 : _height;
+			std::streamsize size = static_cast<std::streamsize>(_width) * (_height / rows);
+			for (int y=0; y<rows && (y == 0 || _in.gcount() == size); ++y) {
+				_in.read(reinterpret_cast<char*>(&image(0, y)), size);
+			}
+
+			//色差
+			if (_in.gcount() == size && _chroma_size > 0) {
+				_in.read(&_skip[0], _chroma_size);
+				size = _chroma_size;
+			}
+
+			if (_in.gcount() != size) {
+				throw file_read_exception("Read failed [truncated Y4M frame]");
+			}
+
+			return true;
+		}
+	};
+}
+
+#endif
+/* vim: set ts=2 sw=2 sts=2 noexpandtab ff=unix ft=cpp fenc=utf-8 : */
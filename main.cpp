@@ -1,44 +1,433 @@
 #define NDEBUG
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 #include <string>
 #include <sstream>
 #include <cmath>
 #include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <chrono>
 
 #include "image/container.hpp"
 #include "image/io.hpp"
 #include "image/math.hpp"
 #include "image/utils.hpp"
 #include "image/algorithm.hpp"
+#include "image/thread.hpp"
+#include "image/frame.hpp"
+#include "image/registry.hpp"
+#include "image/sequence.hpp"
+#include "image/prefetch.hpp"
+#include "image/y4m.hpp"
+#include "image/writer.hpp"
+#include "image/mvfield.hpp"
+#include "image/mvcache.hpp"
+#include "image/metric.hpp"
+#include "image/subpel.hpp"
+#include "image/reference.hpp"
 
-#if defined(MODE_FULL)
-	auto func = Image::search::full();
-	std::string mode = "Full Search";
-#elif defined(MODE_TSS)
-	auto func = Image::search::three_step();
-	std::string mode = "Three Step Search";
-#elif defined(MODE_GS)
-	auto func = Image::search::greedy();
-	std::string mode = "Greedy Search";
-#elif defined(MODE_DS)
-	auto func = Image::search::diamond();
-	std::string mode = "Diamond Search";
-#elif defined(MODE_HEX)
-	auto func = Image::search::hexagon();
-	std::string mode = "Hexagon-based Search";
-#else
-	#error 検索アルゴリズムを定義してください
-#endif
+typedef Image::frame<unsigned char> frame_type;
+typedef Image::search_registry<unsigned char> registry_type;
+
+/**
+ * 1組の画像の評価結果
+ */
+struct pair_result
+{
+	double psnr;
+	Image::search_info info;
+	Image::ve_container vectors;
+
+	//ブロック毎の参照フレームの番号 (空:直前のフレームのみ)
+	Image::container<unsigned char> references;
+
+	//小数画素精度の改良の所要時間 [sec]
+	double refine_time;
+
+	pair_result ()
+		: psnr(0), refine_time(0)
+	{
+	}
+};
+
+/**
+ * 評価の設定
+ */
+struct evaluate_options
+{
+	//マクロブロックのサイズ
+	unsigned int block_size;
+
+	//探索範囲
+	unsigned int search_size;
+
+	//画像外の動きベクトルを許す
+	bool unrestricted;
+
+	//予測画像と残差画像の出力先 (空:出力しない)
+	std::string dump_dir;
+
+	//動きベクトル場の出力先 (空:出力しない)
+	std::string vector_dir;
+
+	//動きベクトル場の符号化方式
+	Image::mv_coding vector_coding;
+
+	//小数画素精度の改良 (1:行わない, 2:1/2 画素, 4:1/4 画素)
+	unsigned int subpel;
+
+	//探索せず vector_dir の動きベクトル場を読み込む
+	bool replay;
+
+	//ファイルの書き込み
+	Image::background_writer *writer;
+
+	//動きベクトル場のキャッシュ (nullptr:使用しない)
+	Image::mv_cache *cache;
+};
+
+/**
+ * 1枚の参照フレームからの予測結果
+ */
+struct reference_result
+{
+	Image::search_info info;
+	Image::ve_container vectors;
+	Image::container<unsigned char> mcmap;
+	double refine_time;
+};
+
+/**
+ * 1枚の参照フレームからの予測
+ *
+ * 動きベクトルを探索 (またはキャッシュから取得) し、小数画素精度の改良と予測画像の作成を行う
+ * 参照フレームの派生データ (拡張画像、補間画像など) はフレームに保持されたものを使う
+ *
+ * @param premap 参照フレーム
+ * @param crtmap 対象画像
+ * @param algorithm 検出アルゴリズム
+ * @param options 評価の設定
+ * @param search_size 探索範囲
+ * @param vector_block 動きベクトル1本あたりのブロックのサイズ
+ * @param replayed 読み込んだ動きベクトル (nullptr:探索する)
+ * @param previous 前の組の動きベクトル (nullptr:無し)
+ * @param pool 探索に使用するスレッドプール
+ * @return 統計情報、整数画素の動きベクトル、予測画像
+ */
+reference_result predict_from (
+	const frame_type &premap,
+	const frame_type &crtmap,
+	const registry_type::entry &algorithm,
+	const evaluate_options &options,
+	const unsigned int search_size,
+	const unsigned int vector_block,
+	const Image::ve_container *replayed,
+	const Image::ve_container *previous,
+	Image::thread_pool *pool )
+{
+	reference_result ret;
+	ret.refine_time = 0;
+
+	if (replayed != nullptr) {
+		ret.vectors = *replayed;
+	}
+	else {
+		//キャッシュの検索
+		std::string key;
+		bool cached = false;
+		if (options.cache != nullptr) {
+			key = Image::mv_cache::key(premap, crtmap, options.block_size, search_size,
+			                           algorithm.key + (options.unrestricted ? ":u" : ""), previous);
+			cached = options.cache->find(key, &ret.vectors, &ret.info);
+		}
+
+		//動きベクトル予測
+		if (!cached) {
+			ret.vectors = algorithm.search(
+				premap, crtmap, options.block_size, search_size, options.unrestricted, previous, &ret.info, pool
+			);
+			if (options.cache != nullptr) {
+				options.cache->store(key, ret.vectors, ret.info);
+			}
+		}
+	}
+
+	//小数画素精度の改良と予測画像の作成 (出力・保持する動きベクトルは整数画素のまま)
+	if (options.subpel > 1) {
+		unsigned int margin = (options.unrestricted || options.replay)
+			? algorithm.margin(vector_block, search_size) : 0;
+		const Image::subpel_planes<unsigned char> &planes = premap.subpel(margin);
+
+		//補間済みの画像は元画像毎に作成済みのものを使い、改良のみを計測する
+		Image::search_info refine;
+		auto start = std::chrono::steady_clock::now();
+		Image::ve_container refined = Image::subpel_refinement(
+			planes, crtmap, ret.vectors, vector_block, Image::search::subpel(options.subpel), &refine, pool);
+		ret.refine_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		ret.info.subpel = refine.subpel;
+
+		ret.mcmap = Image::prediction(planes, refined, vector_block);
+	}
+	//予測画像の作成 (読み込んだ動きベクトルは画像外を指してもよい)
+	else if (options.unrestricted || options.replay) {
+		ret.mcmap = Image::prediction(
+			premap.padded(algorithm.margin(vector_block, search_size)), ret.vectors, vector_block);
+	}
+	else {
+		ret.mcmap = Image::prediction(premap, ret.vectors, vector_block);
+	}
+
+	return ret;
+}
+
+/**
+ * 1組の画像の評価
+ *
+ * 参照フレームが複数の場合は参照フレーム毎に予測し、
+ * ブロック毎に差分絶対値和が最小の参照フレームを選ぶ
+ *
+ * @param references 参照フレーム (新しい順)
+ * @param crtmap 対象画像
+ * @param index 対象画像のフレーム番号
+ * @param algorithm 検出アルゴリズム
+ * @param options 評価の設定
+ * @param dump 予測画像と残差画像を出力する
+ * @param previous 前の組の動きベクトル (nullptr:無し)
+ * @param pool 探索に使用するスレッドプール
+ * @return PSNRと探索の統計情報、動きベクトル
+ */
+pair_result evaluate (
+	const Image::reference_ring<unsigned char> &references,
+	const frame_type &crtmap,
+	const unsigned int index,
+	const registry_type::entry &algorithm,
+	const evaluate_options &options,
+	const bool dump,
+	const Image::ve_container *previous,
+	Image::thread_pool *pool )
+{
+	pair_result ret;
+	Image::container<unsigned char> mcmap;
+	std::string name = std::to_string(index) + "-" + algorithm.key;
+	unsigned int search_size = options.search_size;
+
+	//可変ブロックサイズの探索は部分ブロック毎の動きベクトルを返す
+	unsigned int vector_block = (algorithm.vector_block_size != 0)
+		? algorithm.vector_block_size : options.block_size;
+
+	//保存した動きベクトル場の読み込み
+	Image::mv_field field;
+	if (options.replay) {
+		field = Image::read_mv_field(options.vector_dir + "/" + name + ".mvf");
+
+		//探索範囲は拡張画像の大きさと動きベクトルの検査範囲を決めるため、設定を超えるものは使わない
+		if (field.search_size > options.search_size) {
+			throw Image::file_read_exception("Read failed [search range exceeds the configured range: " + name + "]");
+		}
+		vector_block = field.block_size;
+		search_size  = field.search_size;
+
+		//予測画像の作成前に画像の大きさ、動きベクトルと参照フレームの範囲を検査する
+		Image::check_mv_field(field, crtmap.width(), crtmap.height(),
+		                      algorithm.margin(vector_block, search_size), references.size());
+	}
+
+	//参照フレーム毎の予測 (前の組の動きベクトルは直前のフレームに対するもの)
+	//読み込んだ動きベクトル場が参照フレームを持たない場合は直前のフレームのみを使う
+	unsigned int count = (options.replay && field.references.width() == 0) ? 1 : references.size();
+	std::vector<Image::ve_container> vectors;
+	std::vector<Image::container<unsigned char>> predictions;
+	for (unsigned int k=0; k<count; ++k) {
+		reference_result r = predict_from(
+			references[k], crtmap, algorithm, options, search_size, vector_block,
+			options.replay ? &field.vectors : nullptr, (k == 0) ? previous : nullptr, pool);
+
+		ret.info += r.info;
+		ret.refine_time += r.refine_time;
+		vectors.push_back(std::move(r.vectors));
+		predictions.push_back(std::move(r.mcmap));
+	}
+
+	if (count == 1) {
+		ret.vectors = std::move(vectors.front());
+		mcmap = std::move(predictions.front());
+	}
+	else {
+		//ブロック毎の参照フレームの選択
+		if (options.replay) {
+			ret.references = std::move(field.references);
+		}
+		else {
+			ret.references = Image::select_references(predictions, crtmap,
+				vectors.front().width(), vectors.front().height(), vector_block);
+		}
+		ret.vectors = Image::select_vectors(vectors, ret.references);
+		mcmap = Image::compose_references(predictions, ret.references, vector_block);
+	}
+
+	//動きベクトル場の出力
+	if (!options.replay && !options.vector_dir.empty()) {
+		Image::mv_field field = {vector_block, search_size, algorithm.key, ret.vectors, ret.references};
+		options.writer->write(options.vector_dir + "/" + name + ".mvf",
+		                      Image::encode_mv_field(field, options.vector_coding));
+	}
+
+	//PSNRを計算
+	ret.psnr = Image::measure(mcmap, crtmap).psnr();
+
+	//予測画像と残差画像の出力
+	if (dump) {
+		std::string prefix = options.dump_dir + "/" + name;
+		options.writer->write_pgm(prefix + ".mc.pgm", mcmap);
+		options.writer->write_pgm(prefix + ".res.pgm", Image::residual<unsigned char>(crtmap, mcmap));
+	}
+
+	return ret;
+}
+
+/**
+ * 1組の画像を全ての検出アルゴリズムで評価
+ *
+ * 画像と派生データは検出アルゴリズム間で共有される
+ *
+ * @param references 参照フレーム (新しい順)
+ * @param crtmap 対象画像
+ * @param index 対象画像のフレーム番号
+ * @param algorithms 検出アルゴリズム
+ * @param options 評価の設定
+ * @param dump 予測画像と残差画像を出力する
+ * @param previous 検出アルゴリズム毎の前の組の動きベクトル (nullptr:無し)
+ * @param pool 探索に使用するスレッドプール
+ * @return 検出アルゴリズム毎の評価結果
+ */
+std::vector<pair_result> evaluate_all (
+	const Image::reference_ring<unsigned char> &references,
+	const frame_type &crtmap,
+	const unsigned int index,
+	const std::vector<const registry_type::entry*> &algorithms,
+	const evaluate_options &options,
+	const bool dump,
+	const std::vector<Image::ve_container> *previous,
+	Image::thread_pool *pool )
+{
+	std::vector<pair_result> ret;
+	for (unsigned int k=0; k<algorithms.size(); ++k) {
+		ret.push_back(evaluate(references, crtmap, index, *algorithms[k], options, dump,
+		                       (previous != nullptr) ? &(*previous)[k] : nullptr, pool));
+	}
+	return ret;
+}
+
+/**
+ * 評価結果の出力
+ *
+ * @param name 対象ファイル名
+ * @param result 評価結果
+ * @param label 検出アルゴリズム名 (空:出力しない)
+ */
+void print_result (const std::string &name, const pair_result &result, const std::string &label = "")
+{
+	//PSNRと平均マッチング回数の出力
+	std::cout << "[" << name << "] ";
+	if (!label.empty()) {
+		std::cout << label << " ";
+	}
+	std::cout << "PSNR = " << result.psnr
+	          << " Match = " << result.info.match;
+
+	//枝刈りした平均候補数の出力
+	if (result.info.pruned > 0) {
+		std::cout << " Pruned = " << result.info.pruned;
+	}
+
+	//候補当たりの平均評価行数の出力
+	if (result.info.match > 0) {
+		std::cout << " Rows = " << result.info.rows / result.info.match;
+	}
+
+	//参照フレーム毎のブロック数の出力
+	if (result.references.width() > 0) {
+		std::vector<unsigned int> blocks;
+		for (auto it = result.references.begin(); it != result.references.end(); ++it) {
+			if (*it >= blocks.size()) {
+				blocks.resize(*it + 1, 0);
+			}
+			++blocks[*it];
+		}
+		std::cout << " Refs = ";
+		for (unsigned int k=0; k<blocks.size(); ++k) {
+			std::cout << (k > 0 ? "/" : "") << blocks[k];
+		}
+	}
+
+	//小数画素精度の改良の平均候補数と所要時間の出力
+	if (result.info.subpel > 0) {
+		std::cout << " Subpel = " << result.info.subpel
+		          << " Refine = " << result.refine_time * 1000 << " ms";
+	}
+
+	std::cout << std::endl;
+}
+
+/**
+ * 全ての検出アルゴリズムの評価結果の出力
+ *
+ * 検出アルゴリズムが複数の場合は名前を揃えて並べる
+ *
+ * @param name 対象ファイル名
+ * @param results 検出アルゴリズム毎の評価結果
+ * @param algorithms 検出アルゴリズム
+ */
+void print_results (
+	const std::string &name,
+	const std::vector<pair_result> &results,
+	const std::vector<const registry_type::entry*> &algorithms )
+{
+	if (algorithms.size() == 1) {
+		print_result(name, results.front());
+		return;
+	}
+
+	std::size_t width = 0;
+	for (auto it = algorithms.begin(); it != algorithms.end(); ++it) {
+		width = std::max(width, (*it)->key.size());
+	}
+	for (unsigned int k=0; k<algorithms.size(); ++k) {
+		std::string label = algorithms[k]->key;
+		print_result(name, results[k], label + std::string(width - label.size(), ' '));
+	}
+}
+
+/**
+ * 使用方法の出力
+ *
+ * @param command コマンド名
+ * @param registry 検出アルゴリズムの登録表
+ */
+void print_usage (const std::string &command, const registry_type &registry)
+{
+	std::cout
+		<< "Usage: " << command
+		<< " [-a algorithm[,algorithm...]|all] [-j threads] [-b pairs] [-u] [-q half|quarter] [-n frames] [-s raw|yuv420|y4m] [-p frames]"
+		<< " [-d frame[,frame...]|all] [-o dir] [-v dir [-c fixed|varint] [-r]]"
+		<< " [-k dir [-K megabytes]]"
+		<< " initial-file other-files..."
+		<< std::endl
+		<< "Algorithms:" << std::endl;
+	for (auto it = registry.entries().begin(); it != registry.entries().end(); ++it) {
+		std::cout << "  " << std::left << std::setw(6) << it->key << it->name << std::endl;
+	}
+}
 
 /**
  * main関数
  */
 int main(int argc, char* argv[])
 {
-	//ターゲットファイル名
-	std::vector<std::string> img_files;
-
 	//デフォルト設定: 動き保証のパラメータ
 	unsigned int block_size  = 16;
 	unsigned int search_size = 7;
@@ -47,55 +436,366 @@ int main(int argc, char* argv[])
 	unsigned int width  = 352;
 	unsigned int height = 288;
 
+	//デフォルト設定: 並列数 (0:CPUのコア数)
+	unsigned int threads = 0;
+
+	//デフォルト設定: 同時に評価する画像の組数 (0:逐次評価)
+	unsigned int batch = 0;
+
+	//デフォルト設定: 画像外の動きベクトルを許す
+	bool unrestricted = false;
+
+	//デフォルト設定: 参照フレーム数
+	unsigned int reference_frames = 1;
+
+	//デフォルト設定: 小数画素精度の改良 (空:行わない, half:1/2 画素, quarter:1/4 画素)
+	std::string subpel = "";
+
+	//デフォルト設定: 検出アルゴリズム (カンマ区切りで複数指定すると比較する)
+	std::string algorithm_keys = "full";
+
+	//デフォルト設定: 連続フレームファイルの形式 (空:1ファイル1フレーム, y4m:ストリーム)
+	std::string sequence = "";
+
+	//デフォルト設定: 先読みするフレーム数 (0:先読みしない)
+	unsigned int prefetch = 2;
+
+	//デフォルト設定: 予測画像と残差画像を出力するフレーム番号 (空:出力しない, all:全て)
+	std::string dump_frames = "";
+	std::string dump_dir = ".";
+
+	//デフォルト設定: 動きベクトル場の出力先 (空:出力しない)
+	std::string vector_dir = "";
+	std::string vector_coding = "fixed";
+
+	//デフォルト設定: 探索せずに保存した動きベクトル場を使う
+	bool replay = false;
+
+	//デフォルト設定: 動きベクトル場のキャッシュ (空:使用しない) と上限 [MB]
+	std::string cache_dir = "";
+	unsigned int cache_size = 256;
+
 	//コマンドライン引数の確認
-	if (argc < 3) {
-		std::cout
-			<< "Usage: " << argv[0] << " initial-file other-files..."
-			<< std::endl;
+	int argi = 1;
+	for ( ; argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0'; ++argi) {
+		std::string opt = argv[argi];
+
+		if (opt == "-j" && argi+1 < argc) {
+			threads = std::stoul(argv[++argi]);
+		}
+		else if (opt == "-b" && argi+1 < argc) {
+			batch = std::stoul(argv[++argi]);
+		}
+		else if (opt == "-u") {
+			unrestricted = true;
+		}
+		else if (opt == "-n" && argi+1 < argc) {
+			reference_frames = std::stoul(argv[++argi]);
+		}
+		else if (opt == "-q" && argi+1 < argc) {
+			subpel = argv[++argi];
+		}
+		else if (opt == "-a" && argi+1 < argc) {
+			algorithm_keys = argv[++argi];
+		}
+		else if (opt == "-s" && argi+1 < argc) {
+			sequence = argv[++argi];
+		}
+		else if (opt == "-p" && argi+1 < argc) {
+			prefetch = std::stoul(argv[++argi]);
+		}
+		else if (opt == "-d" && argi+1 < argc) {
+			dump_frames = argv[++argi];
+		}
+		else if (opt == "-o" && argi+1 < argc) {
+			dump_dir = argv[++argi];
+		}
+		else if (opt == "-v" && argi+1 < argc) {
+			vector_dir = argv[++argi];
+		}
+		else if (opt == "-c" && argi+1 < argc) {
+			vector_coding = argv[++argi];
+		}
+		else if (opt == "-r") {
+			replay = true;
+		}
+		else if (opt == "-k" && argi+1 < argc) {
+			cache_dir = argv[++argi];
+		}
+		else if (opt == "-K" && argi+1 < argc) {
+			cache_size = std::stoul(argv[++argi]);
+		}
+		else {
+			argi = argc;
+		}
+	}
+
+	//検出アルゴリズムの選択
+	const registry_type registry = Image::default_search_registry<unsigned char>();
+	std::vector<const registry_type::entry*> algorithms;
+	if (algorithm_keys == "all") {
+		for (auto it = registry.entries().begin(); it != registry.entries().end(); ++it) {
+			algorithms.push_back(&*it);
+		}
+	}
+	else {
+		std::istringstream keys(algorithm_keys);
+		std::string key;
+		while (std::getline(keys, key, ',')) {
+			const registry_type::entry *entry = registry.find(key);
+			if (entry == nullptr) {
+				std::cout << "Unknown algorithm: " << key << std::endl;
+				print_usage(argv[0], registry);
+				return 1;
+			}
+			algorithms.push_back(entry);
+		}
+	}
+
+	//入力フレームの一覧 (表示名, 読み込み処理)
+	typedef Image::container<unsigned char> buffer_type;
+	std::vector<std::pair<std::string, std::function<void(buffer_type&)>>> inputs;
+
+	//Y4Mストリーム (標準入力は "-")
+	std::string source;
+	std::ifstream source_file;
+	std::unique_ptr<Image::y4m_reader> stream;
+
+	if (sequence == "y4m") {
+		if (argc - argi != 1) {
+			print_usage(argv[0], registry);
+			return 0;
+		}
+
+		source = argv[argi];
+		if (source == "-") {
+			std::ios::sync_with_stdio(false);
+			stream.reset(new Image::y4m_reader(std::cin));
+		}
+		else {
+			source_file.open(source.c_str(), std::ios::binary);
+			if (source_file.fail()) {
+				throw Image::file_open_exception("Can't open " + source);
+			}
+			stream.reset(new Image::y4m_reader(source_file));
+		}
+
+		//画像サイズはヘッダに従う
+		width  = stream->width();
+		height = stream->height();
+	}
+
+	for (int i=argi; i < argc && !stream; ++i) {
+		std::string filename = argv[i];
+
+		if (sequence.empty()) {
+			inputs.emplace_back(filename, [=] (buffer_type &buffer) {
+				Image::load<unsigned char>(filename, width, height, buffer);
+			});
+			continue;
+		}
+
+		//連続フレームファイルは全フレームを入力とする
+		if (sequence != "raw" && sequence != "yuv420") {
+			argi = argc;
+			break;
+		}
+		auto file = std::make_shared<const Image::mapped_sequence<unsigned char>>(
+			filename, width, height,
+			(sequence == "raw") ? Image::sequence_format::raw : Image::sequence_format::yuv420 );
+		for (unsigned int k=0; k < file->size(); ++k) {
+			inputs.emplace_back(filename + ":" + std::to_string(k), [=] (buffer_type &buffer) {
+				auto view = (*file)[k];
+				if (buffer.width() != view.width() || buffer.height() != view.height()) {
+					buffer = buffer_type(view.width(), view.height());
+				}
+				std::copy(view.begin(), view.end(), &buffer(0, 0));
+			});
+		}
+	}
+
+	if ((!stream && inputs.size() < 2) || algorithms.empty()
+		|| (vector_coding != "fixed" && vector_coding != "varint")
+		|| (replay && vector_dir.empty())
+		|| (!subpel.empty() && subpel != "half" && subpel != "quarter")
+		|| reference_frames < 1 || reference_frames > 256)
+	{
+		print_usage(argv[0], registry);
 		return 0;
 	}
 
+	//入力フレームの表示名
+	auto frame_name = [&] (const unsigned int index) {
+		return stream ? source + ":" + std::to_string(index) : inputs[index].first;
+	};
+
+	//予測画像と残差画像を出力するフレーム番号
+	bool dump_all = (dump_frames == "all");
+	std::set<unsigned int> dump_set;
+	if (!dump_all) {
+		std::istringstream frames(dump_frames);
+		std::string frame;
+		while (std::getline(frames, frame, ',')) {
+			dump_set.insert(std::stoul(frame));
+		}
+	}
+
+	//予測画像と残差画像、動きベクトル場の書き込み (バックグラウンド)
+	std::unique_ptr<Image::background_writer> writer;
+	if (dump_all || !dump_set.empty() || (!vector_dir.empty() && !replay)) {
+		writer.reset(new Image::background_writer);
+	}
+
+	//評価の設定
+	evaluate_options options;
+	options.block_size    = block_size;
+	options.search_size   = search_size;
+	options.unrestricted  = unrestricted;
+	options.dump_dir      = dump_dir;
+	options.vector_dir    = replay ? vector_dir : (writer ? vector_dir : "");
+	options.vector_coding = (vector_coding == "varint") ? Image::mv_coding::varint : Image::mv_coding::fixed;
+	options.replay        = replay;
+	options.subpel        = subpel.empty() ? 1 : (subpel == "half") ? 2 : 4;
+	options.writer        = writer.get();
+
+	//動きベクトル場のキャッシュ
+	std::unique_ptr<Image::mv_cache> cache;
+	if (!cache_dir.empty() && !replay) {
+		cache.reset(new Image::mv_cache(cache_dir, static_cast<std::size_t>(cache_size) << 20));
+	}
+	options.cache = cache.get();
+
+	//スレッドプールの生成
+	Image::thread_pool pool(threads);
+
 	//設定: 出力設定
 	std::cout.precision(6);
 	std::cout.setf(std::ios::fixed, std::ios::floatfield);
 
+	//入力フレームの先読み
+	//ストリームは保持するフレームを先読み分に限る
+	typedef Image::frame_prefetcher<unsigned char> loader_type;
+	loader_type loader(stream ? loader_type::unbounded : inputs.size(),
+		[&] (const unsigned int index, buffer_type &buffer) {
+			if (stream) {
+				return stream->read(buffer);
+			}
+			inputs[index].second(buffer);
+			return true;
+		}, prefetch);
+
 	//初期画像の読み込み
-	auto premap = Image::load<float>(argv[1], width, height);
-	// Image::write(std::string(argv[1]) + ".pgm", premap);
+	auto premap = loader.next();
+	if (!premap) {
+		print_usage(argv[0], registry);
+		return 0;
+	}
+
+	//参照フレーム (派生データと共に直近のフレームを保持する)
+	Image::reference_ring<unsigned char> references(reference_frames);
+	references.push(std::move(premap));
 
 	//設定の表示
-	std::cout << "Initial file:" << argv[1] << std::endl;
+	std::cout << "Initial file:" << frame_name(0) << std::endl;
 	std::cout << "File width: " << width << std::endl;
 	std::cout << "File height: " << height << std::endl;
 	std::cout << "Macro block size: " << block_size << std::endl;
 	std::cout << "Search pixel size: " << search_size << std::endl;
-	std::cout << "Algorithm: " << mode << std::endl;
+	for (auto it = algorithms.begin(); it != algorithms.end(); ++it) {
+		std::cout << "Algorithm: " << (*it)->name << std::endl;
+	}
+	std::cout << "Threads: " << pool.size() << std::endl;
+	if (batch > 0) {
+		std::cout << "Batch pairs: " << batch << std::endl;
+	}
+	if (unrestricted) {
+		std::cout << "Unrestricted vectors: on" << std::endl;
+	}
+	if (!subpel.empty()) {
+		std::cout << "Sub-pixel refinement: " << subpel << std::endl;
+	}
+	if (reference_frames > 1) {
+		std::cout << "Reference frames: " << reference_frames << std::endl;
+	}
+	std::cout << "Prefetch frames: " << prefetch << std::endl;
+	if (dump_all || !dump_set.empty()) {
+		std::cout << "Dump frames: " << dump_frames << " -> " << dump_dir << std::endl;
+	}
+	if (!vector_dir.empty()) {
+		std::cout << (replay ? "Replay vectors: " : "Vector fields: ") << vector_dir;
+		if (!replay) {
+			std::cout << " (" << vector_coding << ")";
+		}
+		std::cout << std::endl;
+	}
+	if (cache) {
+		std::cout << "Vector cache: " << cache_dir << " (" << cache_size << " MB)" << std::endl;
+	}
 	std::cout << "-----" << std::endl;
 
-	for (int i=2; i < argc; ++i) {
+	//評価中の組 (画像は組が保持する)
+	std::deque<std::pair<std::string, std::future<std::vector<pair_result>>>> results;
+
+	//検出アルゴリズム毎の前の組の動きベクトル (逐次評価のみ)
+	std::vector<Image::ve_container> previous;
+
+	for (unsigned int i=1; ; ++i) {
 		//対象画像の読み込み
-		auto crtmap = Image::load<float>(argv[i], width, height);
-		// Image::write(std::string(argv[i]) + ".pgm", crtmap);
+		auto crtmap = loader.next();
+		if (!crtmap) {
+			break;
+		}
+		const std::string name = frame_name(i);
 
-		//動きベクトル予測
-		double info;
-		auto vec = Image::motion_vector_search(
-		   premap, crtmap, block_size, search_size, func, &info
-		);
+		//予測画像と残差画像を出力するか
+		bool dump = dump_all || dump_set.count(i) > 0;
+
+		if (batch == 0) {
+			auto result = evaluate_all(references, *crtmap, i, algorithms, options, dump,
+			                           (i > 1) ? &previous : nullptr, &pool);
+			print_results(name, result, algorithms);
+
+			previous.clear();
+			for (auto it = result.begin(); it != result.end(); ++it) {
+				previous.push_back(std::move(it->vectors));
+			}
+		}
+		else {
+			//組単位でプールに投入 (組同士は独立に評価する)
+			results.emplace_back(name, pool.async([=, &options, &pool] {
+				return evaluate_all(references, *crtmap, i, algorithms, options, dump, nullptr, &pool);
+			}));
+
+			//入力順に出力し、保持する画像数を制限
+			if (results.size() >= batch) {
+				print_results(results.front().first, results.front().second.get(), algorithms);
+				results.pop_front();
+			}
+		}
 
-		//予測画像の作成
-		auto mcmap = Image::prediction(premap, vec, block_size);
+		//参照フレーム ←  対象画像 (保持数を超えた最も古いフレームを破棄)
+		references.push(std::move(crtmap));
+	}
 
-		//PSNRを計算
-		double mse = sum(pow(mcmap - crtmap, 2.0)) / (crtmap.width() * crtmap.height());
-		double psnr = 20.0 * std::log10(255.0 / std::sqrt(mse));
+	//残りの組の出力
+	for (auto it = results.begin(); it != results.end(); ++it) {
+		print_results(it->first, it->second.get(), algorithms);
+	}
 
-		//PSNRと平均マッチング回数の出力
-		std::cout << "[" << argv[i] << "] PSNR = " << psnr
-		          << " Match = " << info << std::endl;
+	//書き込みの完了待ち
+	if (writer) {
+		writer->flush();
+	}
+
+	//読み込みを待った時間の出力
+	std::cout << "-----" << std::endl;
+	std::cout << "I/O stall: " << loader.stall_time() << " sec ("
+	          << loader.stalls() << "/" << loader.size() << " frames)" << std::endl;
 
-		//元画像 ←  対象画像
-		premap = std::move(crtmap);
+	//キャッシュの利用状況の出力
+	if (cache) {
+		std::cout << "Vector cache: hits = " << cache->hits() << " misses = " << cache->misses()
+		          << " size = " << cache->size() << " bytes" << std::endl;
 	}
 
 	return 0;
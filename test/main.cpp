@@ -2,17 +2,66 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cmath>
 
 #include "../image/container.hpp"
 #include "../image/io.hpp"
 #include "../image/math.hpp"
 #include "../image/utils.hpp"
-#include "../image/argorithm.hpp"
+#include "../image/algorithm.hpp"
+#include "../image/sad.hpp"
+#include "../image/thread.hpp"
+#include "../image/frame.hpp"
+#include "../image/padded.hpp"
+#include "../image/registry.hpp"
+#include "../image/sequence.hpp"
+#include "../image/prefetch.hpp"
+#include "../image/y4m.hpp"
+#include "../image/writer.hpp"
+#include "../image/mvfield.hpp"
+#include "../image/mvcache.hpp"
+#include "../image/metric.hpp"
+#include "../image/view.hpp"
+#include "../image/partition.hpp"
+#include "../image/subpel.hpp"
+#include "../image/reference.hpp"
 
 using namespace Image;
 using namespace std;
 using namespace boost::unit_test_framework;
 
+/**
+ * 探索用の画像の組の作成
+ *
+ * 滑らかな模様の画像と、それを (dx, dy) ずらした画像を作る
+ * ずらした画像の動きベクトルは (dx, dy) となる
+ *
+ * @param width 画像の幅
+ * @param height 画像の高さ
+ * @param dx x方向のずれ
+ * @param dy y方向のずれ
+ * @return 元画像とずらした画像
+ */
+pair<container<unsigned char>, container<unsigned char>> make_shifted_pair (
+	const int width, const int height,
+	const int dx, const int dy )
+{
+	vector<unsigned char> a(width*height), b(width*height);
+	for (int y=0; y<height; ++y) {
+		for (int x=0; x<width; ++x) {
+			a[x + y*width] = static_cast<unsigned char>(128 + 100 * sin(x / 5.0) * cos(y / 7.0));
+			b[x + y*width] = static_cast<unsigned char>(128 + 100 * sin((x+dx) / 5.0) * cos((y+dy) / 7.0));
+		}
+	}
+	return make_pair(
+		container<unsigned char>(width, height, a.begin(), a.end()),
+		container<unsigned char>(width, height, b.begin(), b.end()));
+}
+
 BOOST_AUTO_TEST_CASE(container_create_default)
 {
 	container<float> c;
@@ -38,7 +87,7 @@ BOOST_AUTO_TEST_CASE(container_applys)
 	container<float> c(2, 2, a.begin(), a.end());
 	container<float> d(2, 2, a.begin(), a.end());
 
-	auto e = c+d;
+	auto e = evaluate(c+d);
 	BOOST_CHECK_EQUAL(e.width()  , 2);
 	BOOST_CHECK_EQUAL(e.height() , 2);
 	BOOST_CHECK_EQUAL(e(0,0), 2.0);
@@ -105,6 +154,153 @@ BOOST_AUTO_TEST_CASE(image_load_success)
 	BOOST_CHECK_EQUAL(c(1,1), 51.0);
 }
 
+BOOST_AUTO_TEST_CASE(image_mapped_sequence)
+{
+	BOOST_CHECK_THROW(
+		mapped_sequence<unsigned char>("./sample/image_none.dat", 2, 2),
+		file_open_exception
+	);
+	BOOST_CHECK_THROW(
+		mapped_sequence<unsigned char>("./sample/image_empty.dat", 2, 2),
+		file_read_exception
+	);
+
+	mapped_sequence<unsigned char> raw("./sample/sequence_test1.dat", 2, 2);
+	BOOST_CHECK_EQUAL(raw.size(), 3u);
+	BOOST_CHECK_EQUAL(raw[1](0,0), '4');
+	BOOST_CHECK_EQUAL(raw[2](1,1), 'B');
+
+	mapped_sequence<unsigned char> yuv("./sample/sequence_test1.dat", 2, 2, sequence_format::yuv420);
+	BOOST_CHECK_EQUAL(yuv.size(), 2u);
+	BOOST_CHECK_EQUAL(yuv[1](0,1), '8');
+	BOOST_CHECK_EQUAL(yuv.chroma(0, 0)(0,0), '4');
+	BOOST_CHECK_EQUAL(yuv.chroma(1, 1)(0,0), 'B');
+	BOOST_CHECK(std::equal(yuv[0].begin(), yuv[0].end(), "0123"));
+}
+
+BOOST_AUTO_TEST_CASE(image_y4m_reader)
+{
+	string data = string("YUV4MPEG2 W2 H2 F25:1 C420jpeg\n")
+		+ "FRAME\n0123UV"
+		+ "FRAME Ixyz\n4567UV"
+		+ "FRAME\n89";
+	istringstream in(data);
+
+	y4m_reader reader(in);
+	BOOST_CHECK_EQUAL(reader.width(), 2);
+	BOOST_CHECK_EQUAL(reader.height(), 2);
+
+	container<unsigned char> c;
+	BOOST_CHECK(reader.read(c));
+	BOOST_CHECK_EQUAL(c(1,1), '3');
+	BOOST_CHECK(reader.read(c));
+	BOOST_CHECK_EQUAL(c(0,1), '6');
+	BOOST_CHECK_THROW(reader.read(c), file_read_exception);
+
+	istringstream end(string("YUV4MPEG2 W2 H2 Cmono\nFRAME\n0123"));
+	y4m_reader mono(end);
+	BOOST_CHECK(mono.read(c));
+	BOOST_CHECK(!mono.read(c));
+
+	istringstream bad(string("P5 2 2\n"));
+	BOOST_CHECK_THROW(y4m_reader(bad).width(), file_read_exception);
+}
+
+BOOST_AUTO_TEST_CASE(image_write_pgm)
+{
+	vector<unsigned char> a = {'0', '1', '2', '3', '4', '5'};
+	container<unsigned char> c(3, 2, a.begin(), a.end());
+
+	BOOST_CHECK_EQUAL(encode_pgm(c), "P5\n3 2\n255\n012345");
+
+	{
+		background_writer writer;
+		writer.write_pgm("./sample/_write_test.pgm", c);
+		writer.flush();
+	}
+	ifstream in("./sample/_write_test.pgm", ios::binary);
+	string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	BOOST_CHECK_EQUAL(data, encode_pgm(c));
+	remove("./sample/_write_test.pgm");
+
+	background_writer writer;
+	writer.write_pgm("./sample/none/_write_test.pgm", c);
+	BOOST_CHECK_THROW(writer.flush(), file_open_exception);
+}
+
+BOOST_AUTO_TEST_CASE(container_stride)
+{
+	vector<unsigned char> a = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+	container<unsigned char> c(4, 3, a.begin(), a.end());
+
+	//行の先頭を64バイト境界に揃える
+	unsigned int stride = container<unsigned char>::aligned_stride(4);
+	BOOST_CHECK_EQUAL(stride, 64u);
+	BOOST_CHECK_EQUAL(container<float>::aligned_stride(20, 32), 24u);
+
+	container<unsigned char> d(4, 3, stride);
+	BOOST_CHECK_EQUAL(d.stride(), 64);
+	for (int y=0; y<3; ++y) {
+		BOOST_CHECK_EQUAL(reinterpret_cast<std::size_t>(&d(0, y)) % 64, 0u);
+	}
+
+	//部分コピーと比較は行ピッチに従う
+	std::copy(c, 0, 0, 4, 3, d, 0, 0);
+	BOOST_CHECK_EQUAL(d(3, 2), 12);
+	BOOST_CHECK(d == c);
+	BOOST_CHECK_EQUAL(sum(d), 78.0);
+
+	//予測画像は元画像の行ピッチで作成する
+	vector<ve_pair> v = {{2, 1}, {-2, 1}};
+	ve_container ve(2, 1, v.begin(), v.end());
+	auto f = prediction(d, ve, 2);
+	BOOST_CHECK_EQUAL(f.stride(), 64);
+	BOOST_CHECK_EQUAL(f(0, 0), 7);
+	BOOST_CHECK_EQUAL(f(3, 1), 10);
+	BOOST_CHECK(f == prediction(c, ve, 2));
+
+	//式の代入は行ピッチを保つ
+	container<unsigned char> g(4, 3, stride);
+	g = d - c;
+	BOOST_CHECK_EQUAL(g.stride(), 64);
+	BOOST_CHECK_EQUAL(g(3, 2), 0);
+	g = c.apply([](unsigned char x) { return x * 2; });
+	BOOST_CHECK_EQUAL(g.stride(), 64);
+	BOOST_CHECK_EQUAL(g(3, 2), 24);
+}
+
+BOOST_AUTO_TEST_CASE(container_expression)
+{
+	vector<unsigned char> a = {10, 200, 0, 255};
+	vector<unsigned char> b = {12, 100, 255, 0};
+	container<unsigned char> c(2, 2, a.begin(), a.end());
+	container<unsigned char> d(2, 2, b.begin(), b.end());
+
+	//途中の画像を作らずに評価する (整数の差は桁あふれしない)
+	BOOST_CHECK_EQUAL(sum(pow(c - d, 2.0)), 4.0 + 10000 + 65025 + 65025);
+	BOOST_CHECK_EQUAL(sum(abs(c - d)), 2.0 + 100 + 255 + 255);
+
+	//代入で評価する
+	container<float> e = (c - d).apply([](int v) { return v * 0.5f; });
+	BOOST_CHECK_EQUAL(e(0,0), -1.0);
+	BOOST_CHECK_EQUAL(e(1,1), 127.5);
+
+	//自身を含む式の代入
+	e = e + e - e;
+	BOOST_CHECK_EQUAL(e(1,0), 50.0);
+	BOOST_CHECK_EQUAL(e(0,1), -127.5);
+
+	//加算と減算は同じ式として組み合わせる
+	container<float> f = c - d + c;
+	container<float> g = c + c - d;
+	BOOST_CHECK(f == g);
+	BOOST_CHECK_EQUAL(f(1,0), 300.0);
+
+	//式に関数を適用しても元の画像だけを参照する
+	auto h = (c + d).apply([](int v) { return v / 2; });
+	BOOST_CHECK_EQUAL(evaluate(h)(0,1), 127);
+}
+
 BOOST_AUTO_TEST_CASE(math_pow)
 {
 	vector<char> a = {1, 2, 3, 4};
@@ -157,6 +353,60 @@ BOOST_AUTO_TEST_CASE(utils_prediction)
 	BOOST_CHECK(d == e);
 }
 
+BOOST_AUTO_TEST_CASE(utils_residual)
+{
+	vector<unsigned char> a = {10, 200, 0, 255};
+	vector<unsigned char> b = {12, 100, 255, 0};
+	container<unsigned char> c(2, 2, a.begin(), a.end());
+	container<unsigned char> d(2, 2, b.begin(), b.end());
+
+	auto e = residual(c, d);
+	BOOST_CHECK_EQUAL(e(0,0), 126);
+	BOOST_CHECK_EQUAL(e(1,0), 228);
+	BOOST_CHECK_EQUAL(e(0,1), 0);
+	BOOST_CHECK_EQUAL(e(1,1), 255);
+}
+
+BOOST_AUTO_TEST_CASE(metric_measure)
+{
+	//SIMDの本体と端数の両方を通る大きさ
+	container<unsigned char> c(37, 5), d(37, 5);
+	for (int y=0; y<5; ++y) {
+		for (int x=0; x<37; ++x) {
+			c(x, y) = (x * 37 + y * 11) & 0xff;
+			d(x, y) = (x * 5 + y * 101) & 0xff;
+		}
+	}
+
+	double sse = 0, sad = 0;
+	for (int y=0; y<5; ++y) {
+		for (int x=0; x<37; ++x) {
+			double diff = static_cast<double>(c(x, y)) - d(x, y);
+			sse += diff * diff;
+			sad += std::abs(diff);
+		}
+	}
+
+	auto m = measure(c, d);
+	BOOST_CHECK_EQUAL(m.sse, sse);
+	BOOST_CHECK_EQUAL(m.sad, sad);
+	BOOST_CHECK_EQUAL(m.count, 37.0 * 5);
+	BOOST_CHECK_CLOSE(m.psnr(), 20.0 * std::log10(255.0 / std::sqrt(sse / (37 * 5))), 1e-9);
+
+	//ブロック毎の誤差の合計は全体と一致する
+	container<distortion> blocks;
+	auto n = measure(c, d, 16, &blocks);
+	BOOST_CHECK_EQUAL(blocks.width(), 3);
+	BOOST_CHECK_EQUAL(blocks.height(), 1);
+	BOOST_CHECK_EQUAL(n.sse, sse);
+	BOOST_CHECK_EQUAL(blocks(2, 0).count, 5.0 * 5);
+	BOOST_CHECK_EQUAL(blocks(0, 0).sad + blocks(1, 0).sad + blocks(2, 0).sad, sad);
+
+	//8bit以外の画素
+	container<float> e(37, 5, c.begin(), c.end()), f(37, 5, d.begin(), d.end());
+	BOOST_CHECK_EQUAL(measure(e, f).sse, sse);
+}
+
 BOOST_AUTO_TEST_CASE(algorithm_full_search)
 {
 	vector<char> a = {1,1,2,2,1,1,2,2,3,3,4,4,3,3,4,4};
@@ -167,8 +417,653 @@ BOOST_AUTO_TEST_CASE(algorithm_full_search)
 	vector<pair<int,int>> p = {{2, 2}, {-2, 2}, {2, -2}, {-2, -2}};
 	container<pair<int,int>> pp(2, 2, p.begin(), p.end());
 
-	auto e = full_search(c, d, 2, 2);
+	auto e = motion_vector_search(c, d, 2, 2, search::full(), nullptr);
 
 	BOOST_CHECK(pp == e);
 }
 
+
+BOOST_AUTO_TEST_CASE(sad_kernels)
+{
+	vector<unsigned char> a(48*20), b(48*20);
+	for (std::size_t i=0; i<a.size(); ++i) {
+		a[i] = (i * 37) & 0xff;
+		b[i] = (i * 91 + 13) & 0xff;
+	}
+
+	for (unsigned int w=1; w<=40; ++w) {
+		unsigned int s = sad::scalar(&a[3], 48, &b[5], 48, w, 17);
+		BOOST_CHECK_EQUAL(sad::sse2(&a[3], 48, &b[5], 48, w, 17), s);
+		if (__builtin_cpu_supports("avx2")) {
+			BOOST_CHECK_EQUAL(sad::avx2(&a[3], 48, &b[5], 48, w, 17), s);
+		}
+		BOOST_CHECK_EQUAL(sad::compute(&a[3], 48, &b[5], 48, w, 17), s);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(sad_fixed_kernels)
+{
+	vector<unsigned char> a(48*40), b(48*40);
+	for (std::size_t i=0; i<a.size(); ++i) {
+		a[i] = (i * 37) & 0xff;
+		b[i] = (i * 91 + 13) & 0xff;
+	}
+
+	//奇数行を含む縦幅でも汎用カーネルと一致する
+	for (unsigned int w : {4u, 8u, 16u, 32u}) {
+		for (unsigned int h : {1u, 3u, 4u, w, w+1}) {
+			unsigned int s = sad::scalar(&a[3], 48, &b[5], 48, w, h);
+			BOOST_CHECK_EQUAL(sad::select(w)(&a[3], 48, &b[5], 48, w, h), s);
+			BOOST_CHECK_EQUAL(sad::kernel_for(w)(&a[3], 48, &b[5], 48, w, h), s);
+		}
+	}
+
+	BOOST_CHECK_EQUAL(sad::sse2_fixed<8>(&a[3], 48, &b[5], 48, 8, 9), sad::scalar(&a[3], 48, &b[5], 48, 8, 9));
+	BOOST_CHECK_EQUAL(sad::sse2_fixed<16>(&a[3], 48, &b[5], 48, 16, 9), sad::scalar(&a[3], 48, &b[5], 48, 16, 9));
+	BOOST_CHECK_EQUAL(sad::sse2_fixed<32>(&a[3], 48, &b[5], 48, 32, 9), sad::scalar(&a[3], 48, &b[5], 48, 32, 9));
+
+	std::string name;
+	sad::select(16u, &name);
+	BOOST_CHECK_EQUAL(name, sad::kernel_name() + "/16");
+	BOOST_CHECK(sad::kernel_for(12) == sad::select());
+
+	//ブロックのコピー
+	vector<unsigned char> c(48*40, 0);
+	block_copy<unsigned char>::select(8)(&a[3], 48, &c[50], 48, 8, 8);
+	block_copy<unsigned char>::select(5)(&a[3], 48, &c[60], 48, 5, 2);
+	BOOST_CHECK(std::equal(&a[3], &a[11], &c[50]));
+	BOOST_CHECK(std::equal(&a[3+7*48], &a[11+7*48], &c[50+7*48]));
+	BOOST_CHECK_EQUAL(c[58], 0);
+	BOOST_CHECK(std::equal(&a[3+48], &a[8+48], &c[60+48]));
+}
+
+BOOST_AUTO_TEST_CASE(algorithm_parallel_search)
+{
+	vector<unsigned char> a(64*48), b(64*48);
+	for (std::size_t i=0; i<a.size(); ++i) {
+		a[i] = (i * 7 + (i / 64) * 13) & 0xff;
+		b[i] = (i * 7 + (i / 64) * 13 + 40) & 0xff;
+	}
+	container<unsigned char> c(64, 48, a.begin(), a.end());
+	container<unsigned char> d(64, 48, b.begin(), b.end());
+
+	thread_pool pool(4);
+	search_info info1, info2;
+	auto e1 = motion_vector_search(c, d, 8, 4, search::diamond(), &info1);
+	auto e2 = motion_vector_search(c, d, 8, 4, search::diamond(), &info2, &pool);
+
+	BOOST_CHECK(e1 == e2);
+	BOOST_CHECK_EQUAL(info1.match, info2.match);
+}
+
+BOOST_AUTO_TEST_CASE(thread_pool_nested)
+{
+	thread_pool pool(3);
+	vector<future<int>> results;
+
+	for (int i=0; i<8; ++i) {
+		results.push_back(pool.async([i, &pool] {
+			vector<int> v(16);
+			pool.parallel_for(0, v.size(), [&](int k) { v[k] = i * k; });
+			return std::accumulate(v.begin(), v.end(), 0);
+		}));
+	}
+
+	for (int i=0; i<8; ++i) {
+		BOOST_CHECK_EQUAL(results[i].get(), i * 120);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(algorithm_successive_elimination)
+{
+	vector<unsigned char> a(64*48), b(64*48);
+	for (std::size_t i=0; i<a.size(); ++i) {
+		a[i] = (i * 7 + (i / 64) * 13) & 0xff;
+		b[i] = (i * 5 + (i / 64) * 11 + 40) & 0xff;
+	}
+	frame<unsigned char> c(container<unsigned char>(64, 48, a.begin(), a.end()));
+	frame<unsigned char> d(container<unsigned char>(64, 48, b.begin(), b.end()));
+
+	search_info info1, info2, info3;
+	auto e1 = motion_vector_search(c, d, 8, 4, search::full(), &info1);
+	auto e2 = motion_vector_search(c, d, 8, 4, search::successive_elimination(), &info2);
+	auto e3 = motion_vector_search(c, d, 8, 4, search::successive_elimination(2), &info3);
+
+	BOOST_CHECK(e1 == e2);
+	BOOST_CHECK(e1 == e3);
+	BOOST_CHECK_EQUAL(info1.match, info2.match + info2.pruned);
+	BOOST_CHECK_EQUAL(info1.match, info3.match + info3.pruned);
+	BOOST_CHECK(info3.match <= info2.match);
+}
+
+BOOST_AUTO_TEST_CASE(sad_bounded)
+{
+	vector<unsigned char> a(16*16, 0), b(16*16, 10);
+	unsigned int rows;
+
+	BOOST_CHECK_EQUAL(sad::compute_bounded(&a[0], 16, &b[0], 16, 16, 16, 100000, &rows), 2560u);
+	BOOST_CHECK_EQUAL(rows, 16u);
+
+	BOOST_CHECK(sad::compute_bounded(&a[0], 16, &b[0], 16, 16, 16, 500, &rows) >= 500);
+	BOOST_CHECK(rows < 16u);
+}
+
+BOOST_AUTO_TEST_CASE(padded_edge_replication)
+{
+	vector<char> a = {1, 2, 3, 4};
+	container<float> c(2, 2, a.begin(), a.end());
+	padded<float> p(c, 2);
+
+	BOOST_CHECK_EQUAL(p.width()  , 2);
+	BOOST_CHECK_EQUAL(p.height() , 2);
+	BOOST_CHECK_EQUAL(p(-2,-2), 1.0);
+	BOOST_CHECK_EQUAL(p( 3,-1), 2.0);
+	BOOST_CHECK_EQUAL(p(-1, 3), 3.0);
+	BOOST_CHECK_EQUAL(p( 3, 3), 4.0);
+	BOOST_CHECK_EQUAL(p.integral().sum(-2, -2, 6, 6), 9*1.0 + 9*2.0 + 9*3.0 + 9*4.0);
+}
+
+BOOST_AUTO_TEST_CASE(utils_prediction_padded)
+{
+	vector<char> a = {1,1,2,2,1,1,2,2,3,3,4,4,3,3,4,4};
+	vector<char> b = {1,1,2,2,1,1,2,2,3,3,4,4,3,3,4,4};
+	container<float> c(4, 4, a.begin(), a.end());
+	container<float> d(4, 4, b.begin(), b.end());
+
+	vector<pair<int,int>> p = {{-1, -1}, {0, 0}, {0, 0}, {1, 1}};
+	container<pair<int,int>> pp(2, 2, p.begin(), p.end());
+
+	auto e = prediction(padded<float>(c, 2), pp, 2);
+
+	BOOST_CHECK_EQUAL(e(0,0), 1.0);
+	BOOST_CHECK_EQUAL(e(1,1), 1.0);
+	BOOST_CHECK_EQUAL(e(3,3), 4.0);
+	BOOST_CHECK(d == e);
+}
+
+BOOST_AUTO_TEST_CASE(algorithm_unrestricted_search)
+{
+	vector<unsigned char> a(64*48), b(64*48);
+	for (std::size_t i=0; i<a.size(); ++i) {
+		a[i] = (i * 7 + (i / 64) * 13) & 0xff;
+		b[i] = (i * 5 + (i / 64) * 11 + 40) & 0xff;
+	}
+	frame<unsigned char> c(container<unsigned char>(64, 48, a.begin(), a.end()));
+	frame<unsigned char> d(container<unsigned char>(64, 48, b.begin(), b.end()));
+
+	search_info info1, info2;
+	auto e1 = motion_vector_search(c, d, 8, 4, search::unrestricted<search::full>(), &info1);
+	auto e2 = motion_vector_search(c, d, 8, 4,
+		search::unrestricted<search::successive_elimination>(), &info2);
+
+	BOOST_CHECK(e1 == e2);
+	BOOST_CHECK_EQUAL(info1.match, 81.0);
+	BOOST_CHECK_EQUAL(info1.match, info2.match + info2.pruned);
+}
+
+BOOST_AUTO_TEST_CASE(view_block)
+{
+	auto maps = make_shifted_pair(64, 48, 3, -1);
+	const container<unsigned char> &c = maps.first;
+	const container<unsigned char> &d = maps.second;
+
+	//探索と予測は参照をそのまま受け取る
+	container_view<unsigned char> cv(c), dv(d);
+	auto e1 = motion_vector_search(c, d, 8, 4, search::diamond(), nullptr);
+	auto e2 = motion_vector_search(cv, dv, 8, 4, search::diamond(), nullptr);
+	BOOST_CHECK(e1 == e2);
+	BOOST_CHECK(prediction(cv, e2, 8) == prediction(c, e1, 8));
+
+	//探索窓とマクロブロックの参照
+	container_view<unsigned char> window(c, 8, 8, 24, 24);
+	BOOST_CHECK_EQUAL(window.margin(), 8);
+	BOOST_CHECK_EQUAL(edge_margin(window.block(-8, 0, 8, 8)), 0);
+
+	auto block = window.block(8, 8, 8, 8);
+	BOOST_CHECK_EQUAL(block.data(), &c(16, 16));
+	BOOST_CHECK_EQUAL(block.stride(), 64);
+	BOOST_CHECK_EQUAL(
+		sad::compute(block, container_view<unsigned char>(d, 13, 15, 8, 8)),
+		sad::scalar(&c(16, 16), 64, &d(13, 15), 64, 8, 8));
+
+	//拡張画像の参照は拡張した範囲まで参照できる
+	padded<unsigned char> p(c, 4);
+	container_view<unsigned char> pv(p);
+	BOOST_CHECK_EQUAL(pv.margin(), 4);
+	BOOST_CHECK_EQUAL(pv(-4, -4), c(0, 0));
+
+	//空の画像の参照
+	container<unsigned char> empty;
+	container_view<unsigned char> ev(empty);
+	BOOST_CHECK_EQUAL(ev.width(), 0);
+	BOOST_CHECK_EQUAL(sad::compute(ev, ev), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(frame_pyramid)
+{
+	vector<unsigned char> a = {1,2,3,4, 5,6,7,8, 9,10,11,12, 13,14,15,16};
+	frame<unsigned char> f(container<unsigned char>(4, 4, a.begin(), a.end()));
+
+	auto &p1 = f.pyramid(1);
+	BOOST_CHECK_EQUAL(p1.width()  , 2);
+	BOOST_CHECK_EQUAL(p1.height() , 2);
+	BOOST_CHECK_EQUAL(p1(0,0), 4);
+	BOOST_CHECK_EQUAL(p1(1,1), 14);
+	BOOST_CHECK_EQUAL(f.pyramid(2)(0,0), 9);
+	BOOST_CHECK_EQUAL(&f.pyramid(1), &f.downsampled());
+}
+
+BOOST_AUTO_TEST_CASE(algorithm_hierarchical_search)
+{
+	auto maps = make_shifted_pair(64, 64, 4, -2);
+	frame<unsigned char> c(maps.first);
+	frame<unsigned char> d(maps.second);
+
+	auto e = motion_vector_search(c, d, 16, 7, search::hierarchical(2), nullptr);
+
+	BOOST_CHECK(e(1,1) == ve_pair(4, -2));
+	BOOST_CHECK(e(2,2) == ve_pair(4, -2));
+}
+
+BOOST_AUTO_TEST_CASE(algorithm_three_step_search)
+{
+	auto maps = make_shifted_pair(96, 96, 11, -6);
+	frame<unsigned char> c(maps.first);
+	frame<unsigned char> d(maps.second);
+
+	//初期ステップは探索範囲に合わせて広がる
+	auto e = motion_vector_search(c, d, 16, 15, search::three_step(), nullptr);
+	BOOST_CHECK(e(2,2) == ve_pair(11, -6));
+
+	//探索範囲の外の候補は評価しない
+	for (unsigned int search_size : {2u, 7u}) {
+		auto f = motion_vector_search(c, d, 16, search_size, search::three_step(), nullptr);
+		for (auto it = f.begin(); it != f.end(); ++it) {
+			BOOST_CHECK(std::abs(it->first)  <= static_cast<int>(search_size));
+			BOOST_CHECK(std::abs(it->second) <= static_cast<int>(search_size));
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(search_pattern)
+{
+	//パターンの点は並びの順に展開される
+	typedef search::diamond::small_pattern small;
+	BOOST_CHECK_EQUAL(small::size, 5);
+
+	vector<ve_pair> points;
+	auto push = [&](int dx, int dy) { points.push_back(ve_pair(dx, dy)); };
+	small::for_each(push);
+	vector<ve_pair> expect = {{-1, 0}, {0, 1}, {1, 0}, {0, -1}, {0, 0}};
+	BOOST_CHECK(points == expect);
+
+	//世代を進めると全位置が未評価に戻る
+	search::visited_grid grid;
+	grid.reset(5);
+	grid.mark(2, 3);
+	BOOST_CHECK(grid(2, 3));
+	BOOST_CHECK(!grid(3, 2));
+	grid.reset(5);
+	BOOST_CHECK(!grid(2, 3));
+	grid.reset(9);
+	BOOST_CHECK(!grid(8, 8));
+	grid.mark(8, 8);
+	grid.reset(3);
+	BOOST_CHECK(!grid(2, 2));
+}
+
+BOOST_AUTO_TEST_CASE(algorithm_predictive_search)
+{
+	auto maps = make_shifted_pair(64, 64, 4, -2);
+	frame<unsigned char> c(maps.first);
+	frame<unsigned char> d(maps.second);
+
+	search_info s, p, q;
+	thread_pool pool(4);
+	auto e = motion_vector_search(c, d, 16, 7, search::diamond(), &s);
+	auto f = motion_vector_search(c, d, 16, 7, search::predictive<search::diamond>(), &p);
+	auto g = motion_vector_search(c, d, 16, 7, search::predictive<search::diamond>(&f), &q, &pool);
+
+	BOOST_CHECK(f(2,2) == ve_pair(4, -2));
+	BOOST_CHECK(g(2,2) == ve_pair(4, -2));
+	BOOST_CHECK(p.match < s.match);
+	BOOST_CHECK(q.match < p.match);
+}
+
+BOOST_AUTO_TEST_CASE(algorithm_variable_block_search)
+{
+	//マクロブロックの左右 8 画素で異なる動き
+	auto texture = [](int x, int y) {
+		return static_cast<unsigned char>((x*73 + y*151 + x*y*29 + x*x*17) % 251);
+	};
+	vector<unsigned char> a(64*64), b(64*64);
+	for (int y=0; y<64; ++y) {
+		for (int x=0; x<64; ++x) {
+			a[x + y*64] = texture(x, y);
+			b[x + y*64] = (x % 16 < 8) ? texture(x+2, y-1) : texture(x-3, y+1);
+		}
+	}
+	frame<unsigned char> c(container<unsigned char>(64, 64, a.begin(), a.end()));
+	frame<unsigned char> d(container<unsigned char>(64, 64, b.begin(), b.end()));
+
+	//分割のコストが十分大きければ full search と一致する
+	search_info s, t;
+	auto e = motion_vector_search(c, d, 16, 7, search::full(), &s);
+	auto f = variable_block_search(c, d, 7, search::variable_block(1u << 24), &t);
+	BOOST_REQUIRE_EQUAL(f.vectors.width(), e.width() * 4);
+	BOOST_REQUIRE_EQUAL(f.modes.height(), e.height() * 2);
+	for (int y=0; y<f.vectors.height(); ++y) {
+		for (int x=0; x<f.vectors.width(); ++x) {
+			BOOST_CHECK(f.vectors(x, y) == e(x/4, y/4));
+			BOOST_CHECK(f.modes(x/2, y/2) == partition::p16x16);
+		}
+	}
+	BOOST_CHECK_EQUAL(s.match, t.match);
+
+	//内側のマクロブロックは左右に分割し、それぞれの動きを検出する
+	auto g = variable_block_search(c, d, 7, search::variable_block(), &t);
+	for (int y=4; y<12; ++y) {
+		for (int x=4; x<12; ++x) {
+			BOOST_CHECK(g.modes(x/2, y/2) == partition::p8x16);
+			BOOST_CHECK(g.vectors(x, y) == ((x % 4 < 2) ? ve_pair(2, -1) : ve_pair(-3, 1)));
+		}
+	}
+
+	//登録表からは 4x4 の部分ブロック毎の動きベクトルを返す
+	auto registry = default_search_registry<unsigned char>();
+	auto entry = registry.find("vbs");
+	BOOST_REQUIRE(entry != nullptr);
+	BOOST_CHECK_EQUAL(entry->vector_block_size, 4u);
+	auto h = entry->search(c, d, 16, 7, false, nullptr, &t, nullptr);
+	BOOST_CHECK(std::equal(h.begin(), h.end(), g.vectors.begin()));
+
+	//マクロブロックより小さな画像では統計情報は 0 になる
+	frame<unsigned char> small(container<unsigned char>(8, 8));
+	auto k = variable_block_search(small, small, 7, search::variable_block(), &t);
+	BOOST_CHECK_EQUAL(k.vectors.width(), 0);
+	BOOST_CHECK_EQUAL(t.match, 0.0);
+	BOOST_CHECK_EQUAL(t.cost, 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(algorithm_subpel_refinement)
+{
+	BOOST_CHECK_EQUAL(subpel_integer(-5), -2);
+	BOOST_CHECK_EQUAL(subpel_phase(-5), 3);
+	BOOST_CHECK_EQUAL(subpel_integer(6), 1);
+	BOOST_CHECK_EQUAL(subpel_phase(6), 2);
+
+	frame<unsigned char> c(make_shifted_pair(64, 64, 0, 0).first);
+
+	//位相 0 の画像は元画像と一致し、補間した画像は一度だけ作成する
+	const subpel_planes<unsigned char> &planes = c.subpel(8);
+	BOOST_CHECK(&planes == &c.subpel(8));
+	BOOST_CHECK_EQUAL(planes.margin(), 8);
+	for (int y=-8; y<72; ++y) {
+		for (int x=-8; x<72; ++x) {
+			BOOST_CHECK_EQUAL(planes.plane(0, 0)(x, y), c.padded(8)(x, y));
+		}
+	}
+
+	//SIMD版とスカラー版の補間は一致する
+	container<short> rows(16, 13);
+	container<unsigned char> p(16, 8), q(16, 8);
+	interpolation::horizontal(&c(8, 8), c.stride(), &rows(0, 0), rows.stride(), 16, 13, 3);
+	interpolation::vertical(&rows(0, 2), rows.stride(), &p(0, 0), p.stride(), 16, 8, 1);
+	interpolation::horizontal_scalar(&c(8, 8), c.stride(), &rows(0, 0), rows.stride(), 16, 13, 3);
+	interpolation::vertical_scalar(&rows(0, 2), rows.stride(), &q(0, 0), q.stride(), 16, 8, 1);
+	BOOST_CHECK(p == q);
+
+	//(1 + 2/4, 1/4) 画素ずらした画像から 1/4 画素単位の動きを検出する
+	container<unsigned char> shifted(64, 64);
+	for (int y=0; y<64; ++y) {
+		for (int x=0; x<64; ++x) {
+			shifted(x, y) = planes.plane(2, 1)(x+1, y);
+		}
+	}
+	frame<unsigned char> d(shifted);
+
+	vector<ve_pair> v(16, ve_pair(1, 0));
+	ve_container start(4, 4, v.begin(), v.end());
+	search_info s;
+	auto e = subpel_refinement(planes, d, start, 16, search::subpel(), &s);
+	BOOST_CHECK(std::count(e.begin(), e.end(), ve_pair(6, 1)) == 16);
+	BOOST_CHECK_EQUAL(s.subpel, 16.0);
+	BOOST_CHECK(prediction(planes, e, 16) == shifted);
+
+	//1/2 画素精度では 1/2 画素単位に留まる
+	auto f = subpel_refinement(planes, d, start, 16, search::subpel(2), &s);
+	for (auto it = f.begin(); it != f.end(); ++it) {
+		BOOST_CHECK(it->first % 2 == 0 && it->second % 2 == 0);
+	}
+	BOOST_CHECK_EQUAL(s.subpel, 8.0);
+}
+
+BOOST_AUTO_TEST_CASE(reference_ring_select)
+{
+	//保持数を超えると最も古いフレームを破棄する
+	reference_ring<unsigned char> ring(2);
+	BOOST_CHECK_EQUAL(ring.capacity(), 2u);
+	for (unsigned char i=1; i<=3; ++i) {
+		vector<unsigned char> a(4, i);
+		ring.push(std::make_shared<const frame<unsigned char>>(container<unsigned char>(2, 2, a.begin(), a.end())));
+	}
+	BOOST_CHECK_EQUAL(ring.size(), 2u);
+	BOOST_CHECK_EQUAL(ring[0](0, 0), 3);
+	BOOST_CHECK_EQUAL(ring[1](0, 0), 2);
+
+	//ブロック毎に差分絶対値和が最小の予測画像を選び、等しい場合は新しい方を選ぶ
+	vector<unsigned char> a(8*4, 10), b(8*4, 10), c(8*4, 10);
+	for (int y=0; y<4; ++y) {
+		for (int x=4; x<8; ++x) {
+			a[x + y*8] = 20;
+			b[x + y*8] = 12;
+			c[x + y*8] = 11;
+		}
+	}
+	container<unsigned char> crtmap(8, 4, c.begin(), c.end());
+	vector<container<unsigned char>> predictions = {
+		container<unsigned char>(8, 4, a.begin(), a.end()),
+		container<unsigned char>(8, 4, b.begin(), b.end()) };
+
+	auto refs = select_references(predictions, crtmap, 2, 1, 4);
+	BOOST_CHECK_EQUAL(refs(0, 0), 0);
+	BOOST_CHECK_EQUAL(refs(1, 0), 1);
+
+	auto mcmap = compose_references(predictions, refs, 4);
+	BOOST_CHECK_EQUAL(mcmap(0, 0), 10);
+	BOOST_CHECK_EQUAL(mcmap(5, 2), 12);
+
+	vector<ve_pair> v0 = {{1, 0}, {2, 0}}, v1 = {{3, 0}, {4, 0}};
+	vector<ve_container> fields = {
+		ve_container(2, 1, v0.begin(), v0.end()),
+		ve_container(2, 1, v1.begin(), v1.end()) };
+	auto e = select_vectors(fields, refs);
+	BOOST_CHECK(e(0, 0) == ve_pair(1, 0));
+	BOOST_CHECK(e(1, 0) == ve_pair(4, 0));
+
+	//参照フレームの番号は動きベクトル場と共に保存される
+	mv_field field = {4, 7, "full", e, refs};
+	for (auto coding : {mv_coding::fixed, mv_coding::varint}) {
+		mv_field g = decode_mv_field(encode_mv_field(field, coding));
+		BOOST_CHECK(std::equal(g.vectors.begin(), g.vectors.end(), e.begin()));
+		BOOST_REQUIRE_EQUAL(g.references.width(), 2);
+		BOOST_CHECK(std::equal(g.references.begin(), g.references.end(), refs.begin()));
+	}
+
+	//古い参照フレームを指す動きベクトル場は 1フレームのみ保持する場合には使えない
+	reference_ring<unsigned char> single(1);
+	single.push(std::make_shared<const frame<unsigned char>>(crtmap));
+	BOOST_CHECK_THROW(check_mv_field(field, 8, 4, 4, single.size()), file_read_exception);
+	BOOST_CHECK_NO_THROW(check_mv_field(field, 8, 4, 4, 2));
+
+	field.references = container<unsigned char>();
+	BOOST_CHECK_NO_THROW(check_mv_field(field, 8, 4, 4, single.size()));
+	BOOST_CHECK_EQUAL(decode_mv_field(encode_mv_field(field)).references.width(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(registry_find)
+{
+	auto maps = make_shifted_pair(64, 64, 4, -2);
+	frame<unsigned char> c(maps.first);
+	frame<unsigned char> d(maps.second);
+
+	auto registry = default_search_registry<unsigned char>();
+	BOOST_CHECK(registry.find("none") == nullptr);
+
+	auto entry = registry.find("ds");
+	BOOST_REQUIRE(entry != nullptr);
+
+	search_info s, t;
+	auto e = motion_vector_search(c, d, 16, 7, search::diamond(), &s);
+	auto f = entry->search(c, d, 16, 7, false, nullptr, &t, nullptr);
+
+	BOOST_CHECK(std::equal(e.begin(), e.end(), f.begin()));
+	BOOST_CHECK(s.match == t.match);
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_recycle)
+{
+	//先読みしない (next の呼び出し時に読み込む) ため、領域の再利用はスレッドの実行順に依らない
+	vector<const unsigned char*> buffers;
+	frame_prefetcher<unsigned char> loader(4, [&](unsigned int index, container<unsigned char> &buffer) {
+		if (index == 3) {
+			throw file_read_exception("index 3");
+		}
+		if (buffer.width() != 2) {
+			buffer = container<unsigned char>(2, 2);
+		}
+		buffer(0, 0) = index;
+		return true;
+	}, 0);
+
+	//直前のフレームを保持したまま次のフレームを読み込む
+	std::shared_ptr<const frame<unsigned char>> previous;
+	for (unsigned int i=0; i<3; ++i) {
+		auto f = loader.next();
+		BOOST_REQUIRE(f);
+		BOOST_CHECK_EQUAL((*f)(0, 0), i);
+		buffers.push_back(&(*f)(0, 0));
+		previous = f;
+	}
+	BOOST_CHECK_THROW(loader.next(), file_read_exception);
+	BOOST_CHECK(!loader.next());
+
+	//保持中のフレームの領域は使わず、破棄したフレームの領域が再利用される
+	BOOST_CHECK(buffers[1] != buffers[0]);
+	BOOST_CHECK(buffers[2] == buffers[0]);
+}
+
+BOOST_AUTO_TEST_CASE(mvfield_round_trip)
+{
+	vector<ve_pair> a = {{0, 0}, {3, -2}, {-7, 7}, {1, 1}, {300, -300}, {2, 0}};
+	mv_field field = {16, 7, "full", ve_container(3, 2, a.begin(), a.end()), container<unsigned char>()};
+
+	string fixed = encode_mv_field(field);
+	string varint = encode_mv_field(field, mv_coding::varint);
+	BOOST_CHECK(varint.size() < fixed.size());
+
+	for (auto data : {fixed, varint}) {
+		mv_field g = decode_mv_field(data);
+		BOOST_CHECK_EQUAL(g.block_size, 16u);
+		BOOST_CHECK_EQUAL(g.search_size, 7u);
+		BOOST_CHECK_EQUAL(g.algorithm, "full");
+		BOOST_CHECK(std::equal(g.vectors.begin(), g.vectors.end(), a.begin()));
+	}
+
+	//左との差分が小さい場合は1成分1バイト
+	field.vectors = ve_container(3, 1, a.begin(), a.begin() + 3);
+	BOOST_CHECK_EQUAL(encode_mv_field(field).size(), 18u + 6u);
+
+	BOOST_CHECK_THROW(decode_mv_field(fixed.substr(0, fixed.size() - 1)), file_read_exception);
+	BOOST_CHECK_THROW(decode_mv_field("P5"), file_read_exception);
+}
+
+BOOST_AUTO_TEST_CASE(mvfield_check)
+{
+	vector<ve_pair> a = {{0, 0}, {-4, 2}, {3, -3}, {4, 4}};
+	mv_field field = {16, 4, "full", ve_container(2, 2, a.begin(), a.end()), container<unsigned char>()};
+
+	//拡張範囲内を指す動きベクトル場は受け付ける
+	BOOST_CHECK_NO_THROW(check_mv_field(field, 32, 32, 4));
+	BOOST_CHECK_NO_THROW(check_mv_field(field, 40, 32, 4));
+
+	//大きな画像で保存した動きベクトル場は小さな画像に使えない
+	BOOST_CHECK_THROW(check_mv_field(field, 16, 32, 4), file_read_exception);
+	BOOST_CHECK_THROW(check_mv_field(field, 32, 31, 4), file_read_exception);
+
+	//拡張範囲を超える動きベクトル
+	BOOST_CHECK_THROW(check_mv_field(field, 32, 32, 3), file_read_exception);
+
+	field.block_size = 0;
+	BOOST_CHECK_THROW(check_mv_field(field, 32, 32, 4), file_read_exception);
+}
+
+BOOST_AUTO_TEST_CASE(mvcache_lru)
+{
+	vector<unsigned char> a(32*32, 1), b(32*32, 2);
+	container<unsigned char> c(32, 32, a.begin(), a.end());
+	container<unsigned char> d(32, 32, b.begin(), b.end());
+
+	string k1 = mv_cache::key(c, d, 16, 7, "full");
+	string k2 = mv_cache::key(d, c, 16, 7, "full");
+	string k3 = mv_cache::key(c, d, 16, 7, "ds");
+	BOOST_CHECK(k1 != k2);
+	BOOST_CHECK(k1 != k3);
+	BOOST_CHECK_EQUAL(k1, mv_cache::key(c, d, 16, 7, "full"));
+
+	vector<ve_pair> v = {{1, 2}, {3, 4}, {-5, 6}, {7, -8}};
+	ve_container e(2, 2, v.begin(), v.end());
+	search_info s;
+	s.match = 10;
+
+	{
+		mv_cache cache("./sample/_cache", 1 << 20);
+		ve_container f;
+		search_info t;
+		BOOST_CHECK(!cache.find(k1, &f, &t));
+		cache.store(k1, e, s);
+		BOOST_CHECK(cache.find(k1, &f, &t));
+		BOOST_CHECK(std::equal(f.begin(), f.end(), v.begin()));
+		BOOST_CHECK_EQUAL(t.match, 10.0);
+		BOOST_CHECK_EQUAL(cache.hits(), 1u);
+		BOOST_CHECK_EQUAL(cache.misses(), 1u);
+	}
+
+	//上限は2ファイル分
+	std::size_t one;
+	{
+		mv_cache cache("./sample/_cache", 1 << 20);
+		one = cache.size();
+		BOOST_CHECK(one > 0);
+	}
+	{
+		mv_cache cache("./sample/_cache", 2 * one);
+		ve_container f;
+		cache.store(k2, e, s);
+		BOOST_CHECK(cache.find(k1, &f, nullptr));
+		cache.store(k3, e, s);
+		BOOST_CHECK(cache.find(k1, &f, nullptr));
+		BOOST_CHECK(!cache.find(k2, &f, nullptr));
+		BOOST_CHECK(cache.find(k3, &f, nullptr));
+	}
+
+	//壊れたファイルは登録を取り消して削除する
+	{
+		mv_cache cache("./sample/_cache", 1 << 20);
+		std::size_t total = cache.size();
+		{
+			ofstream out("./sample/_cache/" + k1 + ".mvc", ios::binary);
+			out << "MVC1";
+		}
+		ve_container f;
+		BOOST_CHECK(!cache.find(k1, &f, nullptr));
+		BOOST_CHECK_EQUAL(cache.size(), total - one);
+		BOOST_CHECK(!ifstream("./sample/_cache/" + k1 + ".mvc"));
+		BOOST_CHECK(!cache.find(k1, &f, nullptr));
+		BOOST_CHECK_EQUAL(cache.misses(), 2u);
+	}
+
+	mv_cache cache("./sample/_cache", 0);
+	BOOST_CHECK_EQUAL(cache.size(), 0u);
+	rmdir("./sample/_cache");
+}